@@ -0,0 +1,19 @@
+10 REM ===== OBI-88 BASIC BENCHMARK =====
+20 REM Type BENCH to compare RUN engines
+30 LET total=0
+40 FOR i=1 TO 200
+50 FOR j=1 TO 10
+60 LET total=total+j
+70 NEXT
+80 GOSUB 200
+90 NEXT
+100 LET w=500
+110 WHILE w>0
+120 LET w=w-1
+130 WEND
+140 IF total>0 THEN PRINT "Done"
+150 PRINT total
+160 END
+200 REM ===== SUBROUTINE =====
+210 LET calls=calls+1
+220 RETURN
@@ -0,0 +1,948 @@
+#include "compiler.h"
+#include "variables.h"
+#include "data.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#define MAX_BLOCK_NESTING 32
+#define MAX_NAME 50
+
+typedef struct {
+    int line_num;
+    int pc;
+} LineAddr;
+
+static int optimize = 1;
+
+static const char* compile_statements(CompiledProgram *out, int line_num, const ParsedLine *src,
+                                      int first, int count, int conditional);
+
+static int emit(CompiledProgram *out, uint8_t op, int line_num, const ParsedLine *src,
+                const Token *tokens, int token_count) {
+    if (out->length >= out->capacity) {
+        int new_capacity = out->capacity ? out->capacity * 2 : 64;
+        Instr *grown = realloc(out->code, sizeof(Instr) * new_capacity);
+        if (!grown) return -1;
+        out->code = grown;
+        out->capacity = new_capacity;
+    }
+    Instr *in = &out->code[out->length];
+    memset(in, 0, sizeof(Instr));
+    in->op = op;
+    in->arg = -1;
+    in->line_num = line_num;
+    in->src = src;
+    in->tokens = tokens;
+    in->token_count = token_count;
+    return out->length++;
+}
+
+// Text of the instruction's token at index, as a C string
+static const char* arg_text(const Instr *in, int index, char *buf, int size) {
+    return token_text(in->src->text, &in->tokens[index], buf, size);
+}
+
+// Free expressions owned by the previous compile
+static void release_code(CompiledProgram *out) {
+    for (int pc = 0; pc < out->length; pc++) {
+        expr_free(out->code[pc].expr);
+        expr_free(out->code[pc].limit);
+        expr_free(out->code[pc].step);
+        expr_free(out->code[pc].cond);
+        expr_free(out->code[pc].index);
+        free(out->code[pc].table);
+    }
+    out->length = 0;
+}
+
+// Binary search the line -> pc table (lines are compiled in ascending order)
+static int find_pc(const LineAddr *lines, int count, int line_num) {
+    int lo = 0, hi = count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (lines[mid].line_num == line_num) return lines[mid].pc;
+        if (lines[mid].line_num < line_num) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+static JumpTable* table_alloc(int count, int sparse) {
+    JumpTable *table = malloc(sizeof(JumpTable) + sizeof(int) * count + (sparse ? sizeof(int32_t) * count : 0));
+    if (!table) return NULL;
+    table->low = 0;
+    table->count = count;
+    table->values = sparse ? (int32_t *)(table->targets + count) : NULL;
+    return table;
+}
+
+int jump_table_find(const JumpTable *table, int32_t value) {
+    if (!table->values) {
+        int64_t index = (int64_t)value - table->low;
+        return (index >= 0 && index < table->count) ? table->targets[index] : -1;
+    }
+    int lo = 0, hi = table->count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (table->values[mid] == value) return table->targets[mid];
+        if (table->values[mid] < value) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+// Comma-separated integers; signed allows a leading + or -
+static int parse_int_list(const char *text, int32_t *values, int max, int is_signed) {
+    int count = 0;
+    while (1) {
+        while (*text == ' ' || *text == '\t') text++;
+        const char *digits = (is_signed && (*text == '-' || *text == '+')) ? text + 1 : text;
+        if (!isdigit((unsigned char)*digits) || count >= max) return -1;
+        char *after;
+        values[count++] = strtol(text, &after, 10);
+        text = after;
+        while (*text == ' ' || *text == '\t') text++;
+        if (*text == '\0') return count;
+        if (*text++ != ',') return -1;
+    }
+}
+
+int parse_line_list(const char *text, int *lines, int max) {
+    int32_t values[MAX_JUMP_LIST];
+    int count = parse_int_list(text, values, max < MAX_JUMP_LIST ? max : MAX_JUMP_LIST, 0);
+    for (int i = 0; i < count; i++) {
+        lines[i] = values[i];
+    }
+    return count;
+}
+
+// Sort a sparse table by value, keeping only the first entry for each value,
+// and turn it dense if its values fill at least half of their range.
+// Frees table; returns the result (NULL if out of memory)
+static JumpTable* finish_table(JumpTable *table) {
+    // Stable insertion sort: the first CASE listing a value stays first
+    for (int i = 1; i < table->count; i++) {
+        int32_t value = table->values[i];
+        int target = table->targets[i];
+        int j = i;
+        while (j > 0 && table->values[j - 1] > value) {
+            table->values[j] = table->values[j - 1];
+            table->targets[j] = table->targets[j - 1];
+            j--;
+        }
+        table->values[j] = value;
+        table->targets[j] = target;
+    }
+    int kept = 0;
+    for (int i = 0; i < table->count; i++) {
+        if (kept == 0 || table->values[kept - 1] != table->values[i]) {
+            table->values[kept] = table->values[i];
+            table->targets[kept] = table->targets[i];
+            kept++;
+        }
+    }
+    table->count = kept;
+    if (kept == 0) return table;
+    
+    int64_t range = (int64_t)table->values[kept - 1] - table->values[0] + 1;
+    if (range > 2 * kept) return table;
+    
+    JumpTable *dense = table_alloc(range, 0);
+    if (dense) {
+        dense->low = table->values[0];
+        for (int i = 0; i < range; i++) dense->targets[i] = -1;
+        for (int i = 0; i < kept; i++) {
+            dense->targets[table->values[i] - dense->low] = table->targets[i];
+        }
+    }
+    free(table);
+    return dense;
+}
+
+// END SELECT at end_pc: gather the CASEs of the SELECT at select_pc (chained
+// through their arg, last first) into its jump table. Each CASE becomes a
+// jump to END SELECT, ending the body before it
+// Returns 0 on success, -1 if out of memory
+static int build_select(CompiledProgram *out, int select_pc, int end_pc) {
+    Instr *select = &out->code[select_pc];
+    int total = 0;
+    for (int pc = select->arg; pc >= 0; pc = out->code[pc].arg) {
+        if (out->code[pc].table) total += out->code[pc].table->count;
+    }
+    JumpTable *cases = table_alloc(total, 1);
+    if (!cases) return -1;
+    
+    // Walking backwards, fill from the end so the table keeps source order
+    int default_pc = end_pc;
+    int n = total;
+    for (int pc = select->arg; pc >= 0; ) {
+        Instr *in = &out->code[pc];
+        int previous = in->arg;
+        if (in->table) {
+            for (int i = in->table->count - 1; i >= 0; i--) {
+                n--;
+                cases->values[n] = in->table->values[i];
+                cases->targets[n] = pc + 1;
+            }
+            free(in->table);
+            in->table = NULL;
+        } else {
+            default_pc = pc + 1;  // CASE ELSE
+        }
+        in->op = OP_JUMP;
+        in->arg = end_pc;
+        pc = previous;
+    }
+    out->code[end_pc].op = OP_REM;
+    select->arg = default_pc;
+    select->table = finish_table(cases);
+    return select->table ? 0 : -1;
+}
+
+// Structure: pair every FOR with its NEXT and every WHILE with its WEND,
+// storing each partner's address in arg so loops jump without searching.
+// SELECT CASE blocks get their jump tables here.
+// Returns 0 if every block is matched, -1 (message printed) otherwise
+static int pair_blocks(CompiledProgram *out) {
+    int open[MAX_BLOCK_NESTING];
+    int depth = 0;
+    
+    for (int pc = 0; pc < out->length; pc++) {
+        Instr *in = &out->code[pc];
+        if (in->conditional) {
+            // IF ... THEN NEXT steps whichever loop is running, without closing a block
+            continue;
+        }
+        switch (in->op) {
+            case OP_FOR:
+            case OP_WHILE:
+            case OP_SELECT:
+                if (depth >= MAX_BLOCK_NESTING) {
+                    printf("?NESTING TOO DEEP IN %d\n", in->line_num);
+                    return -1;
+                }
+                open[depth++] = pc;
+                if (in->op == OP_SELECT) {
+                    in->arg = -1;  // No CASEs yet
+                }
+                break;
+            case OP_CASE:
+            case OP_END_SELECT: {
+                if (depth == 0 || out->code[open[depth - 1]].op != OP_SELECT) {
+                    printf("%s IN %d\n", in->op == OP_CASE ? "?CASE WITHOUT SELECT" : "?END SELECT WITHOUT SELECT", in->line_num);
+                    return -1;
+                }
+                Instr *select = &out->code[open[depth - 1]];
+                if (in->op == OP_CASE) {
+                    in->arg = select->arg;
+                    select->arg = pc;
+                } else if (build_select(out, open[--depth], pc) != 0) {
+                    printf("?OUT OF MEMORY IN %d\n", in->line_num);
+                    return -1;
+                }
+                break;
+            }
+            case OP_NEXT:
+            case OP_WEND: {
+                uint8_t opener = (in->op == OP_NEXT) ? OP_FOR : OP_WHILE;
+                if (depth == 0 || out->code[open[depth - 1]].op != opener) {
+                    printf("%s IN %d\n", in->op == OP_NEXT ? "?NEXT WITHOUT FOR" : "?WEND WITHOUT WHILE", in->line_num);
+                    return -1;
+                }
+                int start = open[--depth];
+                if (in->op == OP_NEXT && in->slot >= 0 && in->slot != out->code[start].slot) {
+                    // NEXT j closing FOR i
+                    printf("?NEXT WITHOUT FOR IN %d\n", in->line_num);
+                    return -1;
+                }
+                out->code[start].arg = pc + 1;  // Exit: just past the closer
+                in->arg = start;
+                break;
+            }
+        }
+    }
+    
+    if (depth > 0) {
+        const Instr *in = &out->code[open[depth - 1]];
+        const char *error = "?SELECT WITHOUT END SELECT";
+        if (in->op == OP_FOR) error = "?FOR WITHOUT NEXT";
+        else if (in->op == OP_WHILE) error = "?WHILE WITHOUT WEND";
+        printf("%s IN %d\n", error, in->line_num);
+        return -1;
+    }
+    return 0;
+}
+
+// Link: resolve every GOTO/GOSUB/ON line number to an instruction address,
+// and every RESTORE line number to a DATA pool position.
+// Each undefined target is reported here, once, instead of when it's hit.
+// Returns 0 if every target resolved, -1 otherwise
+static int link_jumps(CompiledProgram *out, const LineAddr *lines, int count) {
+    int status = 0;
+    for (int pc = 0; pc < out->length; pc++) {
+        Instr *in = &out->code[pc];
+        if (in->op == OP_ON_GOTO || in->op == OP_ON_GOSUB) {
+            for (int i = 0; i < in->table->count; i++) {
+                int target = in->table->targets[i];
+                in->table->targets[i] = find_pc(lines, count, target);
+                if (in->table->targets[i] < 0) {
+                    printf("?UNDEF'D STATEMENT %d IN %d\n", target, in->line_num);
+                    status = -1;
+                }
+            }
+            continue;
+        }
+        if (in->op == OP_RESTORE) {
+            // The pool position of the line is fixed until the program is
+            // edited, so RESTORE just sets the cursor
+            int target = in->arg;
+            if (target >= 0 && find_pc(lines, count, target) < 0) {
+                printf("?UNDEF'D STATEMENT %d IN %d\n", target, in->line_num);
+                status = -1;
+            }
+            in->arg = (target >= 0) ? data_position(target) : 0;
+            continue;
+        }
+        if (in->op != OP_GOTO && in->op != OP_GOSUB) continue;
+        
+        // arg holds the target line number until now
+        int target = in->arg;
+        in->arg = find_pc(lines, count, target);
+        if (in->arg < 0) {
+            printf("?UNDEF'D STATEMENT %d IN %d\n", target, in->line_num);
+            status = -1;
+        }
+    }
+    return status;
+}
+
+// Does this instruction's arg hold an address the VM uses?
+static int has_target(uint8_t op) {
+    switch (op) {
+        case OP_IF:
+        case OP_FOR:
+        case OP_WHILE:
+        case OP_WEND:
+        case OP_JUMP:
+        case OP_GOTO:
+        case OP_GOSUB:
+        case OP_INC_IF:
+        case OP_LET_IF:
+        case OP_SELECT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Optimize: peephole rewrites over linked code, then drop what became dead.
+//  - LET v=v+k becomes OP_INC, and PRINT of a lone variable OP_PRINT_VAR
+//  - LET or OP_INC followed by an IF or NEXT that nothing jumps to merges
+//    with it into one superinstruction
+//  - IF with a constant condition becomes a JUMP (false) or goes away (true)
+//  - REMs go away; a jump to one lands on the next instruction instead
+// The stored program text is untouched, so LIST still shows everything.
+// Without memory for the address map the code is left as it is, still valid
+static void optimize_code(CompiledProgram *out) {
+    int length = out->length;
+    Instr *code = out->code;
+    int32_t value;
+    
+    for (int pc = 0; pc < length; pc++) {
+        Instr *in = &code[pc];
+        if (in->op == OP_LET && expr_increment(in->expr, in->slot, &value)) {
+            in->op = OP_INC;
+            in->imm = value;
+        } else if (in->op == OP_IF && expr_constant(in->expr, &value)) {
+            in->op = value ? OP_REM : OP_JUMP;
+        } else if (in->op == OP_PRINT && expr_single_var(in->expr) >= 0) {
+            in->op = OP_PRINT_VAR;
+            in->imm = (in->expr->items[0].op == EXPR_STRVAR);
+            in->slot = in->expr->items[0].arg;
+        }
+    }
+    
+    // new_pc[pc]: where code[pc] (or the next kept instruction) ends up.
+    // It doubles as the "is a jump target" mark until it's filled in
+    int *new_pc = calloc(length + 1, sizeof(int));
+    if (!new_pc) return;
+    for (int pc = 0; pc < length; pc++) {
+        const Instr *in = &code[pc];
+        if (has_target(in->op)) new_pc[in->arg] = 1;
+        // WEND re-enters just after its WHILE; NEXT and RETURN come back to
+        // the instruction after a FOR or GOSUB
+        if (in->op == OP_WEND) new_pc[in->arg + 1] = 1;
+        if (in->op == OP_FOR || in->op == OP_GOSUB || in->op == OP_ON_GOSUB) new_pc[pc + 1] = 1;
+        for (int i = 0; in->table && i < in->table->count; i++) {
+            if (in->table->targets[i] >= 0) new_pc[in->table->targets[i]] = 1;
+        }
+    }
+    
+    for (int pc = 0; pc + 1 < length; pc++) {
+        Instr *in = &code[pc];
+        Instr *next = &code[pc + 1];
+        if ((in->op != OP_LET && in->op != OP_INC) || new_pc[pc + 1]) {
+            continue;
+        }
+        if (next->op == OP_IF) {
+            in->op = (in->op == OP_LET) ? OP_LET_IF : OP_INC_IF;
+            in->cond = next->expr;
+            in->arg = next->arg;
+            next->expr = NULL;
+            next->op = OP_REM;
+        } else if (next->op == OP_NEXT) {
+            in->op = (in->op == OP_LET) ? OP_LET_NEXT : OP_INC_NEXT;
+            in->arg = next->slot;
+            next->op = OP_REM;
+        }
+    }
+    
+    // Compact, then point every jump at the new addresses
+    int kept = 0;
+    for (int pc = 0; pc < length; pc++) {
+        new_pc[pc] = kept;
+        if (code[pc].op == OP_REM) {
+            expr_free(code[pc].expr);
+            continue;
+        }
+        code[kept++] = code[pc];
+    }
+    new_pc[length] = kept;
+    for (int pc = 0; pc < kept; pc++) {
+        if (has_target(code[pc].op)) {
+            code[pc].arg = new_pc[code[pc].arg];
+        }
+        JumpTable *table = code[pc].table;
+        for (int i = 0; table && i < table->count; i++) {
+            if (table->targets[i] >= 0) table->targets[i] = new_pc[table->targets[i]];
+        }
+    }
+    out->length = kept;
+    free(new_pc);
+}
+
+static uint8_t opcode_for(TokenType type) {
+    switch (type) {
+        case TOKEN_REM:
+        case TOKEN_DATA:
+        case TOKEN_DEF:    return OP_REM;
+        case TOKEN_PRINT:  return OP_PRINT;
+        case TOKEN_LET:    return OP_LET;
+        case TOKEN_IF:     return OP_IF;
+        case TOKEN_FOR:    return OP_FOR;
+        case TOKEN_NEXT:   return OP_NEXT;
+        case TOKEN_WHILE:  return OP_WHILE;
+        case TOKEN_WEND:   return OP_WEND;
+        case TOKEN_GOTO:   return OP_GOTO;
+        case TOKEN_GOSUB:  return OP_GOSUB;
+        case TOKEN_RETURN: return OP_RETURN;
+        case TOKEN_END:    return OP_END;
+        case TOKEN_SELECT: return OP_SELECT;
+        case TOKEN_CASE:   return OP_CASE;
+        case TOKEN_READ:   return OP_READ;
+        case TOKEN_RESTORE: return OP_RESTORE;
+        case TOKEN_DIM:    return OP_DIM;
+        case TOKEN_MAT:    return OP_MAT;
+        case TOKEN_SORT:   return OP_SORT;
+        case TOKEN_SEARCH: return OP_SEARCH;
+        case TOKEN_NEW:
+        case TOKEN_LOAD:
+        case TOKEN_RUN:    return OP_CHAIN;
+        default:           return OP_EXEC;
+    }
+}
+
+// "name=expr" as used by LET and FOR, or "name(i, j)=expr" for LET
+// Returns NULL on success or an error message
+static const char* compile_assignment(Instr *in, const char *text) {
+    char name[MAX_NAME];
+    if (expr_parse_name(&text, name, sizeof(name)) != 0) {
+        return "?SYNTAX ERROR";
+    }
+    if (*text == '(' && in->op == OP_LET) {
+        // a(i)=...: the subscripts compile to the element's position
+        in->op = OP_LET_ELEM;
+        in->slot = var_array_slot(name);
+        if (in->slot < 0) return "?TOO MANY VARIABLES";
+        in->index = expr_parse_element(&text, in->slot);
+        if (!in->index) return expr_error();
+    } else {
+        in->slot = var_slot(name);
+        if (in->slot < 0) return "?TOO MANY VARIABLES";
+    }
+    if (*text != '=') {
+        return "?SYNTAX ERROR";
+    }
+    in->expr = expr_compile(text + 1);
+    return in->expr ? NULL : expr_error();
+}
+
+// NEXT or NEXT var: the loop variable's slot, -1 for the innermost loop
+static const char* compile_next(Instr *in) {
+    in->slot = -1;
+    if (in->token_count < 2) return NULL;
+    
+    char buf[MAX_LINE_LENGTH];
+    char name[MAX_NAME];
+    const char *text = arg_text(in, 1, buf, sizeof(buf));
+    if (expr_parse_name(&text, name, sizeof(name)) != 0 || *text != '\0') {
+        return "?SYNTAX ERROR";
+    }
+    in->slot = var_slot(name);
+    return in->slot < 0 ? "?TOO MANY VARIABLES" : NULL;
+}
+
+// Emit a PRINT list: one instruction per item, newline on the last
+static const char* compile_print(CompiledProgram *out, int pc) {
+    const Instr *first = &out->code[pc];
+    const ParsedLine *src = first->src;
+    const Token *tokens = first->tokens;
+    int token_count = first->token_count;
+    uint8_t conditional = first->conditional;
+    Expr *items[MAX_PRINT_ITEMS];
+    char buf[MAX_LINE_LENGTH];
+    int newline;
+    int count = expr_compile_print_list(token_count >= 2 ? arg_text(first, 1, buf, sizeof(buf)) : "", items, &newline);
+    if (count < 0) return expr_error();
+    
+    if (count == 0) {
+        // Bare PRINT just ends the line
+        out->code[pc].op = OP_EXEC;
+        return NULL;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        int item_pc = (i == 0) ? pc : emit(out, OP_PRINT, out->code[pc].line_num, src, tokens, token_count);
+        if (item_pc < 0) {
+            while (i < count) expr_free(items[i++]);
+            return "?OUT OF MEMORY";
+        }
+        out->code[item_pc].conditional = conditional;
+        out->code[item_pc].expr = items[i];
+        out->code[item_pc].arg = (i == count - 1) ? newline : 0;
+    }
+    return NULL;
+}
+
+// Emit a READ list: one instruction per target variable or element
+static const char* compile_read(CompiledProgram *out, int pc) {
+    const Instr *first = &out->code[pc];
+    const ParsedLine *src = first->src;
+    const Token *tokens = first->tokens;
+    int token_count = first->token_count;
+    int line_num = first->line_num;
+    uint8_t conditional = first->conditional;
+    char buf[MAX_LINE_LENGTH];
+    char name[MAX_NAME];
+    if (token_count < 2) return "?SYNTAX ERROR";
+    const char *text = arg_text(first, 1, buf, sizeof(buf));
+    
+    for (int target_pc = pc; ; ) {
+        if (expr_parse_name(&text, name, sizeof(name)) != 0) {
+            return "?SYNTAX ERROR";
+        }
+        Instr *in = &out->code[target_pc];
+        in->conditional = conditional;
+        in->imm = (name[strlen(name) - 1] == '$');
+        if (*text == '(') {
+            in->slot = var_array_slot(name);
+            if (in->slot < 0) return "?TOO MANY VARIABLES";
+            in->index = expr_parse_element(&text, in->slot);
+            if (!in->index) return expr_error();
+            while (*text == ' ' || *text == '\t') text++;
+        } else {
+            in->slot = var_slot(name);
+            if (in->slot < 0) return "?TOO MANY VARIABLES";
+        }
+        if (*text == '\0') return NULL;
+        if (*text++ != ',') return "?SYNTAX ERROR";
+        
+        target_pc = emit(out, OP_READ, line_num, src, tokens, token_count);
+        if (target_pc < 0) return "?OUT OF MEMORY";
+    }
+}
+
+// Emit a DIM list: one instruction per array, its bounds compiled
+static const char* compile_dim(CompiledProgram *out, int pc) {
+    const Instr *first = &out->code[pc];
+    const ParsedLine *src = first->src;
+    const Token *tokens = first->tokens;
+    int token_count = first->token_count;
+    int line_num = first->line_num;
+    uint8_t conditional = first->conditional;
+    char buf[MAX_LINE_LENGTH];
+    char name[MAX_NAME];
+    if (token_count < 2) return "?SYNTAX ERROR";
+    const char *text = arg_text(first, 1, buf, sizeof(buf));
+    
+    for (int array_pc = pc; ; ) {
+        if (expr_parse_name(&text, name, sizeof(name)) != 0 || *text++ != '(') {
+            return "?SYNTAX ERROR";
+        }
+        Instr *in = &out->code[array_pc];
+        in->conditional = conditional;
+        in->slot = var_array_slot(name);
+        if (in->slot < 0) return "?TOO MANY VARIABLES";
+        in->expr = expr_parse(&text);
+        if (!in->expr) return expr_error();
+        if (*text == ',') {
+            text++;
+            in->limit = expr_parse(&text);
+            if (!in->limit) return expr_error();
+        }
+        if (*text++ != ')') return "?SYNTAX ERROR";
+        while (*text == ' ' || *text == '\t') text++;
+        if (*text == '\0') return NULL;
+        if (*text++ != ',') return "?SYNTAX ERROR";
+        
+        array_pc = emit(out, OP_DIM, line_num, src, tokens, token_count);
+        if (array_pc < 0) return "?OUT OF MEMORY";
+    }
+}
+
+// Numeric array named at *text, for MAT: its slot
+static const char* compile_mat_array(const char **text, int *slot) {
+    char name[MAX_NAME];
+    if (expr_parse_name(text, name, sizeof(name)) != 0) return "?SYNTAX ERROR";
+    if (name[strlen(name) - 1] == '$') return "?TYPE MISMATCH";
+    *slot = var_array_slot(name);
+    return *slot < 0 ? "?TOO MANY VARIABLES" : NULL;
+}
+
+// MAT c=a+b, c=a-b, c=a*k, c=a, or MAT s=SUM(a), MIN(a), MAX(a), DOT(a, b)
+static const char* compile_mat(Instr *in) {
+    static const char *const names[] = {"SUM", "MIN", "MAX", "DOT"};
+    char buf[MAX_LINE_LENGTH];
+    char target[MAX_NAME];
+    char function[MAX_NAME];
+    const char *error;
+    if (in->token_count < 2) return "?SYNTAX ERROR";
+    const char *text = arg_text(in, 1, buf, sizeof(buf));
+    if (expr_parse_name(&text, target, sizeof(target)) != 0 || *text++ != '=') {
+        return "?SYNTAX ERROR";
+    }
+    
+    const char *after = text;
+    if (expr_parse_name(&after, function, sizeof(function)) == 0 && *after == '(') {
+        int i = 0;
+        while (i < 4 && strcasecmp(function, names[i]) != 0) {
+            i++;
+        }
+        if (i == 4) return "?SYNTAX ERROR";
+        in->arg = MAT_SUM + i;
+        text = after + 1;
+        if ((error = compile_mat_array(&text, &in->source[0]))) return error;
+        if (in->arg == MAT_DOT) {
+            if (*text++ != ',') return "?SYNTAX ERROR";
+            if ((error = compile_mat_array(&text, &in->source[1]))) return error;
+        }
+        if (*text != ')' || text[1] != '\0') return "?SYNTAX ERROR";
+        if (target[strlen(target) - 1] == '$') return "?TYPE MISMATCH";
+        in->slot = var_slot(target);
+        return in->slot < 0 ? "?TOO MANY VARIABLES" : NULL;
+    }
+    
+    const char *target_text = target;
+    if ((error = compile_mat_array(&target_text, &in->slot))) return error;
+    if ((error = compile_mat_array(&text, &in->source[0]))) return error;
+    char op = *text;
+    if (op == '\0') {
+        in->arg = MAT_COPY;
+        return NULL;
+    }
+    text++;
+    if (op == '*') {
+        in->arg = MAT_SCALE;
+        in->expr = expr_compile(text);
+        return in->expr ? NULL : expr_error();
+    }
+    if (op != '+' && op != '-') return "?SYNTAX ERROR";
+    in->arg = (op == '+') ? MAT_ADD : MAT_SUB;
+    if ((error = compile_mat_array(&text, &in->source[1]))) return error;
+    return (*text == '\0') ? NULL : "?SYNTAX ERROR";
+}
+
+// Array named at *text for SORT and SEARCH, written "a()" or just "a": its slot
+static const char* compile_sort_array(const char **text, int *slot) {
+    char name[MAX_NAME];
+    if (expr_parse_name(text, name, sizeof(name)) != 0) return "?SYNTAX ERROR";
+    if (**text == '(') {
+        const char *p = *text + 1;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != ')') return "?SYNTAX ERROR";
+        for (p++; *p == ' ' || *p == '\t'; p++);
+        *text = p;
+    }
+    *slot = var_array_slot(name);
+    return *slot < 0 ? "?TOO MANY VARIABLES" : NULL;
+}
+
+// SORT a() [DESC|ASC] [, i()]; the index array must be numeric
+static const char* compile_sort(Instr *in) {
+    char buf[MAX_LINE_LENGTH];
+    char word[8];
+    const char *error;
+    if (in->token_count < 2) return "?SYNTAX ERROR";
+    const char *text = arg_text(in, 1, buf, sizeof(buf));
+    if ((error = compile_sort_array(&text, &in->slot))) return error;
+    
+    const char *after = text;
+    if (expr_parse_name(&after, word, sizeof(word)) == 0) {
+        if (strcasecmp(word, "DESC") != 0 && strcasecmp(word, "ASC") != 0) return "?SYNTAX ERROR";
+        in->imm = (toupper((unsigned char)word[0]) == 'D');
+        text = after;
+    }
+    in->source[0] = -1;
+    if (*text == ',') {
+        text++;
+        if ((error = compile_sort_array(&text, &in->source[0]))) return error;
+        const char *name = var_array_name(in->source[0]);
+        if (name[strlen(name) - 1] == '$') return "?TYPE MISMATCH";
+    }
+    return (*text == '\0') ? NULL : "?SYNTAX ERROR";
+}
+
+// SEARCH a(), value, p; p must be numeric
+static const char* compile_search(Instr *in) {
+    char buf[MAX_LINE_LENGTH];
+    char target[MAX_NAME];
+    const char *error;
+    if (in->token_count < 2) return "?SYNTAX ERROR";
+    const char *text = arg_text(in, 1, buf, sizeof(buf));
+    if ((error = compile_sort_array(&text, &in->source[0]))) return error;
+    if (*text++ != ',') return "?SYNTAX ERROR";
+    in->expr = expr_parse(&text);
+    if (!in->expr) return expr_error();
+    if (*text++ != ',' || expr_parse_name(&text, target, sizeof(target)) != 0 || *text != '\0') {
+        return "?SYNTAX ERROR";
+    }
+    if (target[strlen(target) - 1] == '$') return "?TYPE MISMATCH";
+    in->slot = var_slot(target);
+    return in->slot < 0 ? "?TOO MANY VARIABLES" : NULL;
+}
+
+// Compile the expressions of the statement at pc
+// Returns NULL on success or an error message
+static const char* compile_operands(CompiledProgram *out, int pc) {
+    Instr *in = &out->code[pc];
+    const char *error;
+    char buf[MAX_LINE_LENGTH];
+    
+    switch (in->op) {
+        case OP_REM:
+            // DEF FN compiles its body now, once, and leaves nothing to run
+            if (in->tokens[0].type != TOKEN_DEF) return NULL;
+            if (in->token_count < 2) return "?SYNTAX ERROR";
+            return expr_define_function(arg_text(in, 1, buf, sizeof(buf))) == 0 ? NULL : expr_error();
+        case OP_PRINT:
+            return compile_print(out, pc);
+        case OP_LET:
+            if (in->token_count < 2) return "?SYNTAX ERROR";
+            return compile_assignment(in, arg_text(in, 1, buf, sizeof(buf)));
+        case OP_IF:
+        case OP_WHILE:
+            if (in->token_count < 2) return "?SYNTAX ERROR";
+            in->expr = expr_compile(arg_text(in, 1, buf, sizeof(buf)));
+            return in->expr ? NULL : expr_error();
+        case OP_FOR:
+            if (in->token_count < 4) return "?SYNTAX ERROR";
+            error = compile_assignment(in, arg_text(in, 1, buf, sizeof(buf)));
+            if (error) return error;
+            in->limit = expr_compile(arg_text(in, 3, buf, sizeof(buf)));
+            if (!in->limit) return expr_error();
+            if (in->token_count >= 6) {
+                in->step = expr_compile(arg_text(in, 5, buf, sizeof(buf)));
+                if (!in->step) return expr_error();
+            }
+            return NULL;
+        case OP_NEXT:
+            return compile_next(in);
+        case OP_ON_GOTO:
+        case OP_ON_GOSUB: {
+            // ON expr GOTO 100, 200, 300: a dense table from 1
+            int targets[MAX_JUMP_LIST];
+            if (in->token_count < 4) return "?SYNTAX ERROR";
+            int count = parse_line_list(arg_text(in, 3, buf, sizeof(buf)), targets, MAX_JUMP_LIST);
+            if (count < 0) return "?SYNTAX ERROR";
+            in->table = table_alloc(count, 0);
+            if (!in->table) return "?OUT OF MEMORY";
+            in->table->low = 1;
+            memcpy(in->table->targets, targets, sizeof(int) * count);
+            in->expr = expr_compile(arg_text(in, 1, buf, sizeof(buf)));
+            return in->expr ? NULL : expr_error();
+        }
+        case OP_SELECT:
+            if (in->token_count < 2) return "?SYNTAX ERROR";
+            in->expr = expr_compile(arg_text(in, 1, buf, sizeof(buf)));
+            return in->expr ? NULL : expr_error();
+        case OP_CASE: {
+            // CASE ELSE has no table; CASE 1, 5, -2 lists integer constants
+            int32_t values[MAX_JUMP_LIST];
+            if (in->token_count < 2) return "?SYNTAX ERROR";
+            const char *list = arg_text(in, 1, buf, sizeof(buf));
+            if (strcasecmp(list, "ELSE") == 0) return NULL;
+            int count = parse_int_list(list, values, MAX_JUMP_LIST, 1);
+            if (count < 0) return "?SYNTAX ERROR";
+            in->table = table_alloc(count, 1);
+            if (!in->table) return "?OUT OF MEMORY";
+            memcpy(in->table->values, values, sizeof(int32_t) * count);
+            return NULL;
+        }
+        case OP_END_SELECT:
+            return strcasecmp(arg_text(in, 1, buf, sizeof(buf)), "SELECT") == 0 ? NULL : "?SYNTAX ERROR";
+        case OP_READ:
+            return compile_read(out, pc);
+        case OP_DIM:
+            return compile_dim(out, pc);
+        case OP_MAT:
+            return compile_mat(in);
+        case OP_SORT:
+            return compile_sort(in);
+        case OP_SEARCH:
+            return compile_search(in);
+        case OP_RESTORE: {
+            // RESTORE 100 keeps the line number in arg until linking
+            if (in->token_count < 2) return NULL;
+            const char *target = in->src->text + in->tokens[1].start;
+            if (!isdigit((unsigned char)*target)) return "?SYNTAX ERROR";
+            in->arg = atoi(target);
+            return NULL;
+        }
+        case OP_GOTO:
+        case OP_GOSUB: {
+            // GOTO 100, or a bare THEN/ELSE line number. The line number is
+            // kept in arg until linking turns it into an address
+            int index = (in->tokens[0].type == TOKEN_UNKNOWN) ? 0 : 1;
+            if (in->token_count <= index) return "?SYNTAX ERROR";
+            const char *target = in->src->text + in->tokens[index].start;
+            if (!isdigit((unsigned char)*target)) return "?SYNTAX ERROR";
+            in->arg = atoi(target);
+            return NULL;
+        }
+        default:
+            return NULL;
+    }
+}
+
+// IF (statement index of src): when the condition is false, branch to the
+// ELSE part or past the THEN part. Both parts are compiled inline, so they can jump
+static const char* compile_branches(CompiledProgram *out, int if_pc, int index) {
+    const ParsedLine *src = out->code[if_pc].src;
+    const Statement *st = &src->stmts[index];
+    int line_num = out->code[if_pc].line_num;
+    
+    const char *error = compile_statements(out, line_num, src, index + 1, st->then_count, 1);
+    if (error) return error;
+    
+    if (st->else_count == 0) {
+        out->code[if_pc].arg = out->length;
+        return NULL;
+    }
+    
+    // The THEN part skips over the ELSE part
+    int jump = emit(out, OP_JUMP, line_num, src, NULL, 0);
+    if (jump < 0) return "?OUT OF MEMORY";
+    out->code[if_pc].arg = out->length;
+    error = compile_statements(out, line_num, src, index + 1 + st->then_count, st->else_count, 1);
+    if (error) return error;
+    out->code[jump].arg = out->length;
+    return NULL;
+}
+
+// Compile statements first .. first+count-1 of src back to back, so that a
+// GOSUB or FOR in the middle of a line resumes at the next statement.
+// conditional is set for the THEN/ELSE parts of an IF
+// Returns NULL on success or an error message
+static const char* compile_statements(CompiledProgram *out, int line_num, const ParsedLine *src,
+                                      int first, int count, int conditional) {
+    for (int i = first; i < first + count; i++) {
+        const Statement *st = &src->stmts[i];
+        uint8_t op = opcode_for(st->tokens[0].type);
+        if (st->tokens[0].type == TOKEN_UNKNOWN && isdigit((unsigned char)src->text[st->tokens[0].start])) {
+            op = OP_GOTO;  // THEN 100 or ELSE 200
+        } else if (st->tokens[0].type == TOKEN_ON) {
+            op = (st->token_count >= 3 && st->tokens[2].type == TOKEN_GOSUB) ? OP_ON_GOSUB : OP_ON_GOTO;
+        } else if (op == OP_END && st->token_count >= 2) {
+            op = OP_END_SELECT;
+        }
+        if (conditional && (op == OP_FOR || op == OP_WHILE || op == OP_WEND ||
+                            op == OP_SELECT || op == OP_CASE || op == OP_END_SELECT)) {
+            // Blocks must open and close unconditionally
+            return "?SYNTAX ERROR";
+        }
+        
+        if (st->tokens[0].type == TOKEN_BENCH) {
+            // It runs the program itself, which would run this BENCH again
+            return "?ILLEGAL IN PROGRAM";
+        }
+        
+        int pc = emit(out, op, line_num, src, st->tokens, st->token_count);
+        if (pc < 0) return "?OUT OF MEMORY";
+        out->code[pc].conditional = conditional;
+        
+        const char *error = compile_operands(out, pc);
+        if (error) return error;
+        if (op == OP_IF) {
+            // The rest of the statements are the IF's THEN and ELSE parts
+            return compile_branches(out, pc, i);
+        }
+    }
+    return NULL;
+}
+
+void compile_set_optimize(int enabled) {
+    optimize = enabled;
+    expr_set_folding(enabled);
+}
+
+int compile_program(CompiledProgram *out) {
+    int count = prog_line_count();
+    LineAddr *lines = malloc(sizeof(LineAddr) * (count > 0 ? count : 1));
+    if (!lines) {
+        printf("?OUT OF MEMORY\n");
+        return -1;
+    }
+    
+    release_code(out);
+    expr_clear_functions();
+    
+    // Pass 1: compile each line
+    for (int i = 0; i < count; i++) {
+        const ParsedLine *parsed = prog_parsed_at(i);
+        int line_num = prog_line_at(i);
+        lines[i].line_num = line_num;
+        lines[i].pc = out->length;
+        
+        const char *error = compile_statements(out, line_num, parsed, 0, parsed->stmt_count, 0);
+        if (error) {
+            printf("%s IN %d\n", error, line_num);
+            free(lines);
+            release_code(out);
+            return -1;
+        }
+    }
+    if (emit(out, OP_END, -1, NULL, NULL, 0) < 0) {
+        free(lines);
+        release_code(out);
+        printf("?OUT OF MEMORY\n");
+        return -1;
+    }
+    
+    // Pass 2: pair loop blocks; pass 3: link jumps now that every line has an
+    // address; pass 4: optimize the linked code
+    int status = pair_blocks(out);
+    if (status == 0) {
+        status = link_jumps(out, lines, count);
+    }
+    if (status == 0 && optimize) {
+        optimize_code(out);
+    }
+    free(lines);
+    if (status != 0) {
+        release_code(out);
+    }
+    return status;
+}
@@ -0,0 +1,116 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <stdint.h>
+#include "program.h"
+#include "expr.h"
+
+// Instruction opcodes for the RUN engine
+typedef enum {
+    OP_EXEC,      // Plain statement (INPUT, LIST, file commands, ...) run through execute()
+    OP_CHAIN,     // NEW/LOAD/RUN: run through execute(), then stop this program
+    OP_REM,       // Comment, does nothing
+    OP_PRINT,     // Print expr, then a newline if arg is 1
+    OP_LET,       // slot = expr
+    OP_LET_ELEM,  // Element index of the array in slot = expr
+    OP_IF,        // Continue into the THEN part if expr is true, else jump to arg (ELSE part or past THEN)
+    OP_FOR,       // FOR slot = expr TO limit STEP step, body starts at pc + 1; jumps to arg (past the matching NEXT) if it's already past limit
+    OP_NEXT,      // Step the FOR on slot (-1: innermost), jump back to its body while in range; arg is the FOR
+    OP_WHILE,     // Enter loop if expr is true, else jump to arg (past matching WEND)
+    OP_WEND,      // Re-test condition of the WHILE at arg, jump back into its body while true
+    OP_JUMP,      // Jump to arg (set by the compiler, e.g. from THEN over ELSE)
+    OP_GOTO,      // Jump to arg (resolved when linking)
+    OP_GOSUB,     // Push pc + 1, jump to arg (resolved when linking)
+    OP_RETURN,    // Pop return pc
+    OP_END,       // Stop (END statement or end of program)
+    OP_ON_GOTO,   // Jump to table entry expr (1, 2, ...), or fall through when out of range
+    OP_ON_GOSUB,  // As OP_ON_GOTO, pushing pc + 1 when it jumps
+    OP_SELECT,    // Jump to the table entry for expr's value, or to arg (CASE ELSE or END SELECT)
+    OP_CASE,      // Compile time only: CASE becomes a JUMP to its END SELECT
+    OP_END_SELECT, // Compile time only: becomes a REM
+    OP_READ,      // Next DATA item into slot (imm: 1 if it's a string), or into element index of the array in slot
+    OP_RESTORE,   // Move the DATA cursor to pool position arg (a line number until linked, -1 for none)
+    OP_DIM,       // DIM the array in slot with upper bound expr, and limit for a second dimension
+    OP_MAT,       // Whole-array operation arg (a MatOp) on the arrays in source, into the array in slot
+    OP_SORT,      // Sort the array in slot (imm: 1 for descending), filling the index array source[0] (-1 for none)
+    OP_SEARCH,    // Set the variable in slot to where expr is in the sorted array source[0], or -1
+    
+    // Produced by the optimizer only; the fused ones are superinstructions
+    // for statement pairs that often follow each other
+    OP_INC,       // slot += imm (LET v=v+k)
+    OP_INC_IF,    // OP_INC, then continue if cond is true, else jump to arg
+    OP_LET_IF,    // OP_LET, then continue if cond is true, else jump to arg
+    OP_PRINT_VAR, // Print the variable in slot (imm: 1 if it's a string), then a newline if arg is 1
+    OP_LET_NEXT,  // OP_LET, then NEXT on the loop variable in arg (-1: innermost)
+    OP_INC_NEXT,  // OP_INC, then NEXT on the loop variable in arg (-1: innermost)
+} OpCode;
+
+// What an OP_MAT computes. The reductions store into the variable in slot
+typedef enum {
+    MAT_COPY,     // slot = source[0]
+    MAT_ADD,      // slot = source[0] + source[1]
+    MAT_SUB,      // slot = source[0] - source[1]
+    MAT_SCALE,    // slot = source[0] * expr
+    MAT_SUM,
+    MAT_MIN,
+    MAT_MAX,
+    MAT_DOT,      // Of source[0] and source[1]
+} MatOp;
+
+#define MAX_JUMP_LIST 64  // Entries in one ON list or CASE
+
+// Jump table of ON ... GOTO/GOSUB and SELECT CASE. Dense tables index
+// targets by value - low; sparse ones binary search the sorted values
+typedef struct {
+    int32_t low;              // Dense: the value of targets[0]
+    int count;
+    int32_t *values;          // Sparse: sorted values matching targets (NULL if dense)
+    int targets[];            // Addresses (line numbers until linked for ON); -1 for a gap
+} JumpTable;
+
+// One compiled instruction
+typedef struct {
+    uint8_t op;
+    int arg;                  // Resolved jump target pc or flag
+    int line_num;             // Source line number (for error messages)
+    uint8_t conditional;      // Compiled from the THEN/ELSE part of an IF
+    const ParsedLine *src;    // Stored line this instruction was compiled from
+    const Token *tokens;      // The statement's tokens within src (main, THEN or ELSE part)
+    int token_count;
+    Expr *expr;               // Value, condition or FOR start
+    Expr *limit;              // FOR end value, second bound of OP_DIM
+    Expr *step;               // FOR STEP value (NULL for 1)
+    Expr *cond;               // Condition of OP_LET_IF and OP_INC_IF
+    Expr *index;              // Element position of OP_LET_ELEM and OP_READ
+    JumpTable *table;         // ON and SELECT targets (CASE: its values until paired)
+    int slot;                 // Target variable (or array) of LET and FOR, loop variable of NEXT
+    int source[2];            // Arrays OP_MAT reads, SORT's index array, the array SEARCH looks in
+    int32_t imm;              // Constant added by OP_INC*, string flag of OP_PRINT_VAR and OP_READ
+    const void *handler;      // Handler address, set by the VM when it dispatches by threading
+} Instr;
+
+// A compiled program: flat instruction array ending in OP_END
+typedef struct {
+    Instr *code;
+    int length;
+    int capacity;
+} CompiledProgram;
+
+// Compile the stored program into a flat instruction array, pair its loop
+// blocks and link its jumps. Runs on every RUN, so edits are always picked up.
+// Unmatched FOR/NEXT or WHILE/WEND is reported here rather than at runtime.
+// Returns 0 on success, -1 on error (messages already printed)
+int compile_program(CompiledProgram *out);
+
+// Address for value in a jump table, or -1 if it has none
+int jump_table_find(const JumpTable *table, int32_t value);
+
+// Parse a comma-separated list of line numbers ("100, 200, 300") into lines
+// Returns how many were stored (at most max), or -1 if the list is malformed
+int parse_line_list(const char *text, int *lines, int max);
+
+// Turn the optimizer (constant folding, REM removal, peephole rewrites) on
+// or off for later compiles. On by default; off is for timing comparisons
+void compile_set_optimize(int enabled);
+
+#endif
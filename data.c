@@ -0,0 +1,205 @@
+#include "data.h"
+#include "program.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+typedef struct {
+    int32_t num;            // Value of a numeric item
+    uint16_t offset;        // Text of the item in pool_text
+    uint16_t length;
+    uint8_t is_number;
+} DataItem;
+
+// First item of each line holding DATA, in line order, for RESTORE line
+typedef struct {
+    int line_num;
+    int first;
+} DataLine;
+
+// Item texts are copied out of the program: the arena moves line texts
+// whenever any line is edited, not just the ones holding DATA. They come
+// from the arena, so they fit 16-bit offsets
+static DataItem *items = NULL;
+static int item_count = 0;
+static int item_capacity = 0;
+static char *pool_text = NULL;
+static int text_used = 0;
+static int text_capacity = 0;
+static DataLine *data_lines = NULL;
+static int data_line_count = 0;
+static int data_line_capacity = 0;
+static int cursor = 0;
+static int stale = 1;           // The program's DATA changed since the last build
+
+// Make room for one more element in a growable array. Returns -1 if out of memory
+static int reserve(void **array, int *capacity, int count, int need, int size) {
+    if (count + need <= *capacity) {
+        return 0;
+    }
+    int new_capacity = *capacity ? *capacity * 2 : 32;
+    while (new_capacity < count + need) {
+        new_capacity *= 2;
+    }
+    void *grown = realloc(*array, (size_t)new_capacity * size);
+    if (!grown) {
+        return -1;
+    }
+    *array = grown;
+    *capacity = new_capacity;
+    return 0;
+}
+
+// Check for an optionally signed run of digits filling text[0 .. length)
+static int is_number(const char *text, int length) {
+    int i = (length > 0 && (text[0] == '-' || text[0] == '+')) ? 1 : 0;
+    if (i == length) {
+        return 0;
+    }
+    for (; i < length; i++) {
+        if (!isdigit((unsigned char)text[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Value of a number checked by is_number, wrapping past the int32 range
+// just as the same literal does in an expression
+static int32_t number(const char *text) {
+    char sign = *text;
+    if (sign == '-' || sign == '+') text++;
+    int32_t value = expr_parse_number(&text);
+    return (sign == '-') ? (int32_t)(0u - (uint32_t)value) : value;
+}
+
+static int add_item(const char *text, int length, int quoted) {
+    if (reserve((void **)&items, &item_capacity, item_count, 1, sizeof(DataItem)) != 0 ||
+        reserve((void **)&pool_text, &text_capacity, text_used, length + 1, 1) != 0) {
+        return -1;
+    }
+    DataItem *item = &items[item_count++];
+    item->offset = text_used;
+    item->length = length;
+    item->is_number = !quoted && is_number(text, length);
+    item->num = item->is_number ? number(text) : 0;
+    memcpy(&pool_text[text_used], text, length);
+    text_used += length;
+    return 0;
+}
+
+// Items of one DATA statement: text[0 .. end), separated by commas. Bare
+// items are trimmed; a quoted one keeps its spaces and commas
+static int add_items(const char *text, const char *end) {
+    while (1) {
+        while (text < end && (*text == ' ' || *text == '\t')) text++;
+        int status;
+        if (text < end && *text == '"') {
+            const char *start = ++text;
+            while (text < end && *text != '"') text++;
+            status = add_item(start, text - start, 1);
+            if (text < end) text++;
+            while (text < end && *text != ',') text++;
+        } else {
+            const char *start = text;
+            while (text < end && *text != ',') text++;
+            const char *stop = text;
+            while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t')) stop--;
+            status = add_item(start, stop - start, 0);
+        }
+        if (status != 0) return -1;
+        if (text >= end) return 0;
+        text++;
+    }
+}
+
+void data_invalidate(void) {
+    stale = 1;
+}
+
+// Parse every DATA statement of the stored program into the pool
+static void build(void) {
+    item_count = 0;
+    text_used = 0;
+    data_line_count = 0;
+    cursor = 0;
+    
+    int count = prog_line_count();
+    for (int i = 0; i < count; i++) {
+        const ParsedLine *parsed = prog_parsed_at(i);
+        int first = item_count;
+        for (int s = 0; s < parsed->stmt_count; s++) {
+            const Statement *st = &parsed->stmts[s];
+            if (st->tokens[0].type != TOKEN_DATA || st->token_count < 2) {
+                continue;
+            }
+            const char *text = parsed->text + st->tokens[1].start;
+            if (add_items(text, text + st->tokens[1].length) != 0) {
+                printf("?OUT OF MEMORY\n");
+                return;
+            }
+        }
+        if (item_count == first) {
+            continue;
+        }
+        if (reserve((void **)&data_lines, &data_line_capacity, data_line_count, 1, sizeof(DataLine)) != 0) {
+            printf("?OUT OF MEMORY\n");
+            return;
+        }
+        data_lines[data_line_count].line_num = prog_line_at(i);
+        data_lines[data_line_count].first = first;
+        data_line_count++;
+    }
+}
+
+static void refresh(void) {
+    if (stale) {
+        stale = 0;
+        build();
+    }
+}
+
+int data_position(int line_num) {
+    refresh();
+    int lo = 0, hi = data_line_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (data_lines[mid].line_num < line_num) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < data_line_count ? data_lines[lo].first : item_count;
+}
+
+void data_seek(int position) {
+    refresh();
+    cursor = position;
+}
+
+int data_read(Value *value, int want_string) {
+    refresh();
+    if (cursor >= item_count) {
+        printf("?OUT OF DATA\n");
+        return -1;
+    }
+    const DataItem *item = &items[cursor];
+    if (!want_string && !item->is_number) {
+        printf("?TYPE MISMATCH\n");
+        return -1;
+    }
+    cursor++;
+    value->is_string = want_string;
+    value->in_heap = 0;
+    value->num = item->num;
+    value->str = &pool_text[item->offset];
+    value->len = item->length;
+    return 0;
+}
+
+int data_count(void) {
+    refresh();
+    return item_count;
+}
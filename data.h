@@ -0,0 +1,31 @@
+#ifndef DATA_H
+#define DATA_H
+
+#include "expr.h"
+
+// The values of the program's DATA statements, parsed into a typed pool
+// so READ only copies the next value out and never looks at program text.
+// Items are numbers ("12", "-3") or strings ("quoted" or bare words).
+// The pool is rebuilt on first use after the program's DATA has changed,
+// so pasting a long listing doesn't rebuild it once per line
+
+// Mark the pool out of date: a line holding DATA was stored, replaced or
+// deleted. The READ cursor goes back to the start
+void data_invalidate(void);
+
+// Pool position of the first item on line_num or a later line: what
+// RESTORE line_num moves to. The end of the pool if there's none
+int data_position(int line_num);
+
+// Move the READ cursor to a position from data_position (0: the start)
+void data_seek(int position);
+
+// Take the next item. A number read into a string gives the text it was
+// written as. Returns 0, or -1 (message printed) if the DATA has run out
+// or a string is read into a number
+int data_read(Value *value, int want_string);
+
+// Items in the pool
+int data_count(void);
+
+#endif
@@ -1,12 +1,21 @@
 #include "execute.h"
 #include "variables.h"
+#include "expr.h"
 #include "program.h"
 #include "loops.h"
 #include "filesystem.h"
+#include "vm.h"
+#include "compiler.h"
+#include "strheap.h"
+#include "mat.h"
+#include "sort.h"
+#include "data.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <strings.h>
+#include <ctype.h>
 #include "pico/stdlib.h"
 
 // Global interrupt flag for Ctrl-C handling
@@ -21,172 +30,502 @@ int should_stop_execution(void) {
     return 0;
 }
 
-// Helper to check if a string is a number
-static int is_number(const char *str) {
-    if (!str || *str == '\0') return 0;
-    char *endptr;
-    strtol(str, &endptr, 10);
-    return *endptr == '\0';
+void print_expr(const Expr *item) {
+    Value value;
+    if (expr_eval(item, &value) != 0) return;
+    
+    if (value.is_string) {
+        printf("%.*s", (int)value.len, value.str);
+    } else {
+        int slot = expr_single_var(item);
+        if (slot >= 0 && !var_defined(slot)) {
+            printf("?UNDEFINED VARIABLE: %s", var_slot_name(slot));
+        } else {
+            printf("%ld", (long)value.num);
+        }
+    }
 }
 
-// Helper to compare values
-static int compare(const char *left, const char *op, const char *right) {
-    // Try to convert to numbers
-    int left_num = atoi(left);
-    int right_num = atoi(right);
+static void execute_print(const char *line, const Token *tokens, int token_count) {
+    Expr *items[MAX_PRINT_ITEMS];
+    char buf[MAX_LINE_LENGTH];
+    int newline;
+    int count = expr_compile_print_list(token_count >= 2 ? token_text(line, &tokens[1], buf, sizeof(buf)) : "", items, &newline);
+    if (count < 0) {
+        printf("%s\n", expr_error());
+        return;
+    }
     
-    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
-        return strcmp(left, right) == 0;
-    } else if (strcmp(op, "<") == 0) {
-        return left_num < right_num;
-    } else if (strcmp(op, ">") == 0) {
-        return left_num > right_num;
-    } else if (strcmp(op, "<=") == 0) {
-        return left_num <= right_num;
-    } else if (strcmp(op, ">=") == 0) {
-        return left_num >= right_num;
-    } else if (strcmp(op, "<>") == 0) {
-        return strcmp(left, right) != 0;
+    for (int i = 0; i < count; i++) {
+        print_expr(items[i]);
+        expr_free(items[i]);
+    }
+    
+    // A trailing semicolon keeps the cursor on this line
+    if (newline) {
+        printf("\n");
     }
-    return 0;
 }
 
-static void execute_print(Token* tokens, int token_count) {
+static void execute_let(const char *line, const Token *tokens, int token_count) {
+    char buf[MAX_LINE_LENGTH];
     if (token_count < 2) return;
-    
-    // Process all print arguments (tokens 1 through token_count-1)
-    for (int i = 1; i < token_count; i++) {
-        const char *arg = tokens[i].value;
-        
-        // Check if it's a string literal (was originally quoted)
-        if (tokens[i].is_string_literal) {
-            printf("%s", arg);
-        }
-        // Check if it's a string variable (ends with $)
-        else if (strlen(arg) > 0 && arg[strlen(arg) - 1] == '$') {
-            const char *val = var_get(arg);
-            if (val != NULL) {
-                printf("%s", val);
-            } else {
-                printf("?UNDEFINED VARIABLE: %s", arg);
-            }
-        } 
-        // Check if it's a number literal
-        else if (is_number(arg)) {
-            printf("%s", arg);
-        }
-        // Check if it's a variable name (single word, no quotes, no spaces)
-        else if (strlen(arg) > 0 && arg[0] != '"' && !strchr(arg, ' ')) {
-            const char *val = var_get(arg);
-            if (val != NULL) {
-                printf("%s", val);
-            } else {
-                printf("?UNDEFINED VARIABLE: %s", arg);
+    var_set(token_text(line, &tokens[1], buf, sizeof(buf)));
+}
+
+// Compile and evaluate a numeric expression held in text
+static int eval_number(const char *text, int32_t *result) {
+    Expr *expr = expr_compile(text);
+    if (!expr) {
+        printf("%s\n", expr_error());
+        return -1;
+    }
+    int status = expr_eval_number(expr, result);
+    expr_free(expr);
+    return status;
+}
+
+// DIM a(10), s$(5, 5), ...: the bounds may be any numeric expressions
+static void execute_dim(const char *text) {
+    char name[50];
+    while (1) {
+        if (expr_parse_name(&text, name, sizeof(name)) != 0 || *text != '(') {
+            printf("?SYNTAX ERROR\n");
+            return;
+        }
+        int32_t bounds[MAX_ARRAY_DIMS];
+        int count = 0;
+        do {
+            text++;
+            if (count == MAX_ARRAY_DIMS) {
+                printf("?SYNTAX ERROR\n");
+                return;
+            }
+            Expr *expr = expr_parse(&text);
+            if (!expr) {
+                printf("%s\n", expr_error());
+                return;
             }
-        } 
-        // Otherwise it's a string literal (from quotes or spaces)
-        else {
-            printf("%s", arg);
+            int status = expr_eval_number(expr, &bounds[count++]);
+            expr_free(expr);
+            if (status != 0) {
+                return;
+            }
+        } while (*text == ',');
+        if (*text != ')') {
+            printf("?SYNTAX ERROR\n");
+            return;
         }
         
-        // If this token doesn't have a semicolon, print newline after it
-        // Otherwise continue on same line
-        if (!tokens[i].has_semicolon && i == token_count - 1) {
-            printf("\n");
+        int slot = var_array_slot(name);
+        if (slot < 0) {
+            printf("?OUT OF MEMORY\n");
+            return;
         }
+        if (var_dim(slot, bounds, count) != 0) {
+            return;
+        }
+        text++;
+        while (*text == ' ' || *text == '\t') text++;
+        if (*text == '\0') {
+            return;
+        }
+        if (*text != ',') {
+            printf("?SYNTAX ERROR\n");
+            return;
+        }
+        text++;
     }
 }
 
-static void execute_let(Token* tokens, int token_count) {
-    if (token_count < 2) return;
-    var_set(tokens[1].value);
+// Storage of the numeric array named at *text, for MAT. NULL (message
+// printed) if it's a string array or hasn't been DIM'd
+static int32_t* mat_operand(const char **text, int32_t *length) {
+    char name[50];
+    if (expr_parse_name(text, name, sizeof(name)) != 0) {
+        printf("?SYNTAX ERROR\n");
+        return NULL;
+    }
+    if (name[strlen(name) - 1] == '$') {
+        printf("?TYPE MISMATCH\n");
+        return NULL;
+    }
+    int slot = var_array_slot(name);
+    int32_t *data = (slot >= 0) ? var_array_numbers(slot, length) : NULL;
+    if (!data) {
+        printf("?UNDIM'D ARRAY %s\n", name);
+    }
+    return data;
 }
 
-static int evaluate_condition(const char *condition) {
-    // Parse condition like "x>5" or "x$=\"hello\""
-    char left[256], op[10], right[256];
+// MAT s=SUM(a), MIN(a), MAX(a) or DOT(a, b); text is past the '('
+static void mat_reduce(const char *target, const char *function, const char *text) {
+    static const char *const names[] = {"SUM", "MIN", "MAX", "DOT"};
+    int op = 0;
+    while (op < 4 && strcasecmp(function, names[op]) != 0) {
+        op++;
+    }
+    if (op == 4) {
+        printf("?SYNTAX ERROR\n");
+        return;
+    }
     
-    // Find comparison operator
-    if (strchr(condition, '<')) {
-        if (strstr(condition, "<=")) {
-            sscanf(condition, "%[^<]<=%s", left, right);
-            strcpy(op, "<=");
-        } else if (strstr(condition, "<>")) {
-            sscanf(condition, "%[^<]<>%s", left, right);
-            strcpy(op, "<>");
-        } else {
-            sscanf(condition, "%[^<]<%s", left, right);
-            strcpy(op, "<");
+    int32_t n, nb, result;
+    int32_t *a = mat_operand(&text, &n);
+    if (!a) return;
+    if (op == 3) {
+        if (*text++ != ',') {
+            printf("?SYNTAX ERROR\n");
+            return;
         }
-    } else if (strchr(condition, '>')) {
-        if (strstr(condition, ">=")) {
-            sscanf(condition, "%[^>]>=%s", left, right);
-            strcpy(op, ">=");
-        } else {
-            sscanf(condition, "%[^>]>%s", left, right);
-            strcpy(op, ">");
+        int32_t *b = mat_operand(&text, &nb);
+        if (!b) return;
+        if (nb != n) {
+            printf("?DIMENSION MISMATCH\n");
+            return;
         }
-    } else if (strchr(condition, '=')) {
-        sscanf(condition, "%[^=]=%s", left, right);
-        strcpy(op, "=");
+        result = mat_dot(a, b, n);
     } else {
-        return 0;
+        result = (op == 0) ? mat_sum(a, n) : (op == 1) ? mat_min(a, n) : mat_max(a, n);
+    }
+    if (*text != ')' || text[1] != '\0') {
+        printf("?SYNTAX ERROR\n");
+        return;
+    }
+    if (target[strlen(target) - 1] == '$') {
+        printf("?TYPE MISMATCH\n");
+        return;
+    }
+    var_set_number(target, result);
+}
+
+// MAT c=a+b, c=a-b, c=a*k, c=a, or MAT s=SUM(a), MIN(a), MAX(a), DOT(a, b):
+// whole numeric arrays at once, through the kernels in mat.c. The arrays
+// must have as many elements as each other; s is a numeric variable
+static void execute_mat(const char *text) {
+    char target[50];
+    char function[50];
+    if (expr_parse_name(&text, target, sizeof(target)) != 0 || *text != '=') {
+        printf("?SYNTAX ERROR\n");
+        return;
     }
+    text++;
     
-    // Trim spaces from left
-    int len = strlen(left);
-    while (len > 0 && left[len - 1] == ' ') left[--len] = '\0';
+    const char *after = text;
+    if (expr_parse_name(&after, function, sizeof(function)) == 0 && *after == '(') {
+        mat_reduce(target, function, after + 1);
+        return;
+    }
+    
+    int32_t n, na, nb;
+    const char *target_text = target;
+    int32_t *dst = mat_operand(&target_text, &n);
+    if (!dst) return;
+    int32_t *a = mat_operand(&text, &na);
+    if (!a) return;
+    if (na != n) {
+        printf("?DIMENSION MISMATCH\n");
+        return;
+    }
     
-    // Trim spaces from right
-    len = strlen(right);
-    while (len > 0 && right[len - 1] == ' ') right[--len] = '\0';
+    char op = *text;
+    if (op == '\0') {
+        mat_copy(dst, a, n);
+    } else if (op == '+' || op == '-') {
+        text++;
+        int32_t *b = mat_operand(&text, &nb);
+        if (!b) return;
+        if (nb != n) {
+            printf("?DIMENSION MISMATCH\n");
+        } else if (*text != '\0') {
+            printf("?SYNTAX ERROR\n");
+        } else if (op == '+') {
+            mat_add(dst, a, b, n);
+        } else {
+            mat_sub(dst, a, b, n);
+        }
+    } else if (op == '*') {
+        int32_t k;
+        if (eval_number(text + 1, &k) == 0) {
+            mat_scale(dst, a, k, n);
+        }
+    } else {
+        printf("?SYNTAX ERROR\n");
+    }
+}
+
+// Array named at *text for SORT and SEARCH, written "a()" or just "a".
+// Returns its slot, or -1 (message printed) if it hasn't been DIM'd
+static int sort_operand(const char **text, int32_t *length) {
+    char name[50];
+    if (expr_parse_name(text, name, sizeof(name)) != 0) {
+        printf("?SYNTAX ERROR\n");
+        return -1;
+    }
+    if (**text == '(') {
+        const char *p = *text + 1;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != ')') {
+            printf("?SYNTAX ERROR\n");
+            return -1;
+        }
+        for (p++; *p == ' ' || *p == '\t'; p++);
+        *text = p;
+    }
+    int slot = var_array_slot(name);
+    if (slot >= 0 && (var_array_numbers(slot, length) || var_array_strings(slot, length))) {
+        return slot;
+    }
+    printf("?UNDIM'D ARRAY %s\n", name);
+    return -1;
+}
+
+// SORT a() [DESC] [, i()]: sort a numeric or string array in place, a 2-D
+// array as one list in row order. Equal elements keep their order, and
+// i(k) is set to the position the element now in a(k) came from
+static void execute_sort(const char *text) {
+    int32_t n, count;
+    int slot = sort_operand(&text, &n);
+    if (slot < 0) return;
     
-    // Remove quotes from right if present
-    if (right[0] == '"') {
-        memmove(right, right + 1, strlen(right));
-        len = strlen(right);
-        if (len > 0 && right[len - 1] == '"') {
-            right[len - 1] = '\0';
+    int descending = 0;
+    char word[8];
+    const char *after = text;
+    if (expr_parse_name(&after, word, sizeof(word)) == 0) {
+        if (strcasecmp(word, "DESC") != 0 && strcasecmp(word, "ASC") != 0) {
+            printf("?SYNTAX ERROR\n");
+            return;
         }
+        descending = (toupper((unsigned char)word[0]) == 'D');
+        text = after;
     }
     
-    // Get variable values if they're variables
-    const char *left_val = var_get(left);
-    const char *right_val = var_get(right);
+    int32_t *order = NULL;
+    if (*text == ',') {
+        text++;
+        int index = sort_operand(&text, &count);
+        if (index < 0) return;
+        order = var_array_numbers(index, &count);
+        if (!order) {
+            printf("?TYPE MISMATCH\n");
+            return;
+        }
+        if (count != n) {
+            printf("?DIMENSION MISMATCH\n");
+            return;
+        }
+    }
+    if (*text != '\0') {
+        printf("?SYNTAX ERROR\n");
+        return;
+    }
     
-    // If not a variable, use the literal value
-    if (left_val == NULL) left_val = left;
-    if (right_val == NULL) right_val = right;
+    int32_t *nums = var_array_numbers(slot, &n);
+    int status = nums ? sort_numbers(nums, n, descending, order)
+                      : sort_strings(var_array_strings(slot, &n), n, descending, order);
+    if (status != 0) {
+        printf("?OUT OF MEMORY\n");
+    }
+}
+
+// SEARCH a(), value, p: binary search of an array SORTed either way; p is
+// set to the first position holding value, or -1 if there's none
+static void execute_search(const char *text) {
+    int32_t n;
+    int slot = sort_operand(&text, &n);
+    if (slot < 0) return;
+    if (*text++ != ',') {
+        printf("?SYNTAX ERROR\n");
+        return;
+    }
+    Expr *expr = expr_parse(&text);
+    if (!expr) {
+        printf("%s\n", expr_error());
+        return;
+    }
+    char target[50];
+    if (*text++ != ',' || expr_parse_name(&text, target, sizeof(target)) != 0 || *text != '\0') {
+        printf("?SYNTAX ERROR\n");
+        expr_free(expr);
+        return;
+    }
     
-    return compare(left_val, op, right_val);
+    // A string literal lives in the expression, so it's freed last
+    Value value;
+    int32_t *nums = var_array_numbers(slot, &n);
+    if (expr_eval(expr, &value) == 0) {
+        if (value.is_string != !nums || target[strlen(target) - 1] == '$') {
+            printf("?TYPE MISMATCH\n");
+        } else {
+            var_set_number(target, nums ? search_numbers(nums, n, value.num)
+                                        : search_strings(var_array_strings(slot, &n), n, value.str, value.len));
+        }
+    }
+    expr_free(expr);
 }
 
-static void execute_if(Token* tokens, int token_count) {
-    if (token_count < 2) return;
+// READ a, b$, c(i): assign the next DATA items in turn
+static void execute_read(const char *text) {
+    char name[50];
+    while (1) {
+        if (expr_parse_name(&text, name, sizeof(name)) != 0) {
+            printf("?SYNTAX ERROR\n");
+            return;
+        }
+        int want_string = (name[strlen(name) - 1] == '$');
+        Value value;
+        if (*text == '(') {
+            int slot = var_array_slot(name);
+            if (slot < 0) {
+                printf("?OUT OF MEMORY\n");
+                return;
+            }
+            Expr *index = expr_parse_element(&text, slot);
+            if (!index) {
+                printf("%s\n", expr_error());
+                return;
+            }
+            int32_t position;
+            int status = expr_eval_number(index, &position);
+            expr_free(index);
+            if (status != 0 || data_read(&value, want_string) != 0) {
+                return;
+            }
+            var_array_set(slot, position, &value);
+            while (*text == ' ' || *text == '\t') text++;
+        } else {
+            if (data_read(&value, want_string) != 0) {
+                return;
+            }
+            var_assign(name, &value);
+        }
+        if (*text == '\0') {
+            return;
+        }
+        if (*text++ != ',') {
+            printf("?SYNTAX ERROR\n");
+            return;
+        }
+    }
+}
+
+// RESTORE or RESTORE line: the next READ takes the first DATA item (on
+// that line or after it)
+static void execute_restore(const char *target) {
+    if (!target) {
+        data_seek(0);
+    } else if (!isdigit((unsigned char)*target)) {
+        printf("?SYNTAX ERROR\n");
+    } else if (prog_get_line(atoi(target)) == NULL) {
+        printf("?UNDEF'D STATEMENT %d\n", atoi(target));
+    } else {
+        data_seek(data_position(atoi(target)));
+    }
+}
+
+// MEM: what the program, its variables and its strings take up
+static void execute_mem(void) {
+    printf("Program:   %d lines, %d bytes, %d DATA items\n", prog_line_count(), prog_text_bytes(), data_count());
+    printf("Variables: %d, arrays: %d (%ld bytes)\n", var_count_defined(), var_array_count(), (long)var_array_bytes());
+    printf("Strings:   %d bytes used, %d free\n", STRING_HEAP_SIZE - strheap_free(), strheap_free());
+}
+
+int evaluate_condition(const char *condition) {
+    // Condition like "x>5", "x$=\"hello\"" or "a+1>b*2"
+    Expr *expr = expr_compile(condition);
+    if (!expr) {
+        printf("%s\n", expr_error());
+        return 0;
+    }
+    int result = expr_eval_condition(expr);
+    expr_free(expr);
+    return result;
+}
+
+// A bare line number as the THEN or ELSE part is a GOTO
+// Returns like execute()
+static int execute_goto_number(const char *target) {
+    int target_line = atoi(target);
+    if (prog_get_line(target_line) == NULL) {
+        printf("?UNDEF'D STATEMENT %d\n", target_line);
+        return -1;
+    }
+    return target_line;
+}
+
+// Check line[start .. end) for FOR, NEXT, WHILE or WEND. Loops jump back
+// to a stored line, so a line typed at the prompt can't hold one
+static int has_loop(const char *line, int start, int end) {
+    while (start < end) {
+        int stop = statement_end(line, start, end);
+        Token tokens[MAX_TOKENS];
+        int token_count = tokenize_range(line, start, stop, tokens, MAX_TOKENS);
+        start = stop + 1;
+        if (token_count > 0 && (tokens[0].type == TOKEN_FOR || tokens[0].type == TOKEN_NEXT ||
+                                tokens[0].type == TOKEN_WHILE || tokens[0].type == TOKEN_WEND)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Run the ':'-separated statements in line[start .. end) in order, stopping
+// at the first one that jumps or ends the program. Returns like execute()
+static int execute_statements(const char *line, int start, int end, int line_num) {
+    if (line_num < 0 && has_loop(line, start, end)) {
+        printf("?ILLEGAL DIRECT ERROR\n");
+        return -1;
+    }
+    while (start < end) {
+        int stop = statement_end(line, start, end);
+        Token tokens[MAX_TOKENS];
+        int token_count = tokenize_range(line, start, stop, tokens, MAX_TOKENS);
+        start = stop + 1;
+        if (token_count == 0) continue;
+        
+        int next = execute(line, tokens, token_count, line_num);
+        if (next != -1) return next;
+    }
+    return -1;
+}
+
+int execute_line(const char *line) {
+    int result = execute_statements(line, 0, strlen(line), -1);
+    loop_init();  // Nothing typed at the prompt leaves a loop or GOSUB open
+    return result;
+}
+
+static int execute_if(const char *line, const Token *tokens, int token_count, int line_num) {
+    if (token_count < 2) return -1;
     
-    const char *condition = tokens[1].value;
+    char condition[MAX_LINE_LENGTH];
+    token_text(line, &tokens[1], condition, sizeof(condition));
     
-    if (evaluate_condition(condition)) {
-        // Condition is true, execute the command after THEN
-        if (token_count >= 4) {
-            // tokens[3] contains the command (e.g., "PRINT \"x is big\"")
-            // Re-tokenize and execute it
-            int cmd_token_count;
-            Token* cmd_tokens = tokenize(tokens[3].value, &cmd_token_count);
-            execute(cmd_tokens, cmd_token_count, -1);  // Immediate mode
-            free_tokens(cmd_tokens);
-        }
+    // tokens[3] is the THEN part (e.g., "PRINT \"x is big\": x=0" or "100"),
+    // tokens[5] the ELSE part
+    int branch = evaluate_condition(condition) ? 3 : 5;
+    if (token_count <= branch) return -1;
+    
+    const Token *part = &tokens[branch];
+    if (isdigit((unsigned char)line[part->start])) {
+        return execute_goto_number(line + part->start);
     }
+    return execute_statements(line, part->start, part->start + part->length, line_num);
 }
 
-static void execute_input(Token* tokens, int token_count) {
+static void execute_input(const char *line, const Token *tokens, int token_count) {
     if (token_count < 3) {
         printf("INPUT requires a variable\n");
         return;
     }
     
-    const char *prompt = tokens[1].value;
-    const char *var_name = tokens[2].value;
+    // No quoted prompt leaves an empty slice
+    char prompt[MAX_LINE_LENGTH] = "? ";
+    if (tokens[1].length > 0) {
+        token_text(line, &tokens[1], prompt, sizeof(prompt));
+    }
+    char name_buf[MAX_LINE_LENGTH];
+    const char *var_name = token_text(line, &tokens[2], name_buf, sizeof(name_buf));
     
     // Determine if this is a numeric variable (doesn't end with $)
     bool is_string_var = (strlen(var_name) > 0 && var_name[strlen(var_name) - 1] == '$');
@@ -213,13 +552,11 @@ static void execute_input(Token* tokens, int token_count) {
                 input_line[0] = '\0';
                 len = 0;
                 // Set variable to 0 or "" and return to abort gracefully
-                char assign_str[512];
                 if (is_string_var) {
-                    snprintf(assign_str, sizeof(assign_str), "%s=\"\"", var_name);
+                    var_set_string(var_name, "");
                 } else {
-                    snprintf(assign_str, sizeof(assign_str), "%s=0", var_name);
+                    var_set_number(var_name, 0);
                 }
-                var_set(assign_str);
                 return;  // Return to calling code
             }
             
@@ -264,13 +601,11 @@ static void execute_input(Token* tokens, int token_count) {
         if (trim_len == 0) {
             // For testing purposes, allow empty input
             // Empty = 0 for numbers, empty string for strings
-            char assign_str[512];
             if (is_string_var) {
-                snprintf(assign_str, sizeof(assign_str), "%s=\"\"", var_name);
+                var_set_string(var_name, "");
             } else {
-                snprintf(assign_str, sizeof(assign_str), "%s=0", var_name);
+                var_set_number(var_name, 0);
             }
-            var_set(assign_str);
             return;
         }
         
@@ -303,57 +638,371 @@ static void execute_input(Token* tokens, int token_count) {
         }
         
         // Valid input received, set the variable
-        char assignment[512];
-        snprintf(assignment, sizeof(assignment), "%s=%s", var_name, trimmed);
-        var_set(assignment);
+        if (is_string_var) {
+            var_set_string(var_name, trimmed);
+        } else {
+            var_set_number(var_name, atoi(trimmed));
+        }
         break;  // Exit the retry loop
     }
 }
 
-int execute(Token* tokens, int token_count, int line_num) {
+// Line-by-line path: run statements first .. first+count-1 of a stored line,
+// taking an IF's THEN or ELSE part. Returns like execute()
+static int run_parsed(const ParsedLine *parsed, int first, int count, int run_line) {
+    char cond[MAX_LINE_LENGTH];
+    for (int i = first; i < first + count; i++) {
+        const Statement *st = &parsed->stmts[i];
+        const Token *toks = st->tokens;
+        if (toks[0].type == TOKEN_UNKNOWN && isdigit((unsigned char)parsed->text[toks[0].start])) {
+            return execute_goto_number(parsed->text + toks[0].start);
+        }
+        if (toks[0].type == TOKEN_IF) {
+            // THEN/ELSE statements were tokenized when the line was stored
+            if (st->token_count >= 2 && evaluate_condition(token_text(parsed->text, &toks[1], cond, sizeof(cond)))) {
+                return run_parsed(parsed, i + 1, st->then_count, run_line);
+            }
+            return run_parsed(parsed, i + 1 + st->then_count, st->else_count, run_line);
+        }
+        int next = execute(parsed->text, toks, st->token_count, run_line);
+        if (next != -1) return next;
+    }
+    return -1;
+}
+
+// Line after the NEXT that closes the FOR on for_line, or -1 if there's none
+static int line_after_next(int for_line) {
+    int depth = 0;
+    int line = for_line;
+    while ((line = prog_next_line(line)) >= 0) {
+        const ParsedLine *parsed = prog_get_parsed(line);
+        if (!parsed || parsed->stmt_count == 0) continue;
+        TokenType type = parsed->stmts[0].tokens[0].type;
+        if (type == TOKEN_FOR) {
+            depth++;
+        } else if (type == TOKEN_NEXT && depth-- == 0) {
+            return prog_next_line(line);
+        }
+    }
+    return -1;
+}
+
+// Line-by-line RUN path (tokens per line, line number lookups).
+// Kept so BENCH can compare it against the bytecode engine. Loops and
+// returns resume at the start of a line, so FOR and WHILE are only
+// handled as the first statement of a line here.
+// Returns the number of lines run
+static uint32_t run_lines(void) {
+    uint32_t executed = 0;
+    int run_line = prog_first_line();
+    while (run_line >= 0) {
+        // Check for Ctrl-C interrupt
+        if (should_stop_execution()) {
+            printf("BREAK\n");
+            break;  // Exit RUN loop
+        }
+        
+        const ParsedLine *parsed = prog_get_parsed(run_line);
+        executed++;
+        if (parsed && parsed->stmt_count > 0) {
+            const Token *toks = parsed->stmts[0].tokens;
+            int tc = parsed->stmts[0].token_count;
+            char cond[MAX_LINE_LENGTH];
+            
+            // Special handling for FOR and WHILE loops
+            if (toks[0].type == TOKEN_FOR) {
+                // Execute FOR to set up the loop, but pass next line as body start
+                int next_line_for_body = prog_next_line(run_line);
+                execute(parsed->text, toks, tc, next_line_for_body);
+                if (!loop_for_should_continue()) {
+                    // Already past the limit: skip the body, as the VM does
+                    loop_pop();
+                    run_line = line_after_next(run_line);
+                    continue;
+                }
+                run_line = prog_next_line(run_line);
+                continue;
+            }
+            if (toks[0].type == TOKEN_WHILE) {
+                execute(parsed->text, toks, tc, run_line);
+                
+                // Evaluate condition
+                if (!evaluate_condition(token_text(parsed->text, &toks[1], cond, sizeof(cond)))) {
+                    // Condition false, skip to line after WEND
+                    int skip_line = run_line;
+                    while ((skip_line = prog_next_line(skip_line)) >= 0) {
+                        const ParsedLine *skip = prog_get_parsed(skip_line);
+                        if (skip && skip->stmt_count > 0 && skip->stmts[0].tokens[0].type == TOKEN_WEND) {
+                            loop_pop();
+                            run_line = prog_next_line(skip_line);
+                            goto continue_run;
+                        }
+                    }
+                    loop_pop();
+                    run_line = prog_next_line(run_line);
+                    continue;
+                }
+                // Condition true, enter loop body
+                run_line = prog_next_line(run_line);
+                continue;
+            }
+            int next_line = run_parsed(parsed, 0, parsed->stmt_count, run_line);
+            if (next_line == -2) {
+                // END statement - terminate program execution
+                break;
+            } else if (next_line >= 0) {
+                run_line = next_line;  // Jump to specified line
+            } else {
+                run_line = prog_next_line(run_line);  // Continue sequentially
+            }
+        } else {
+            run_line = prog_next_line(run_line);
+        }
+        continue_run:;
+    }
+    return executed;
+}
+
+// The line-by-line path resumes loops and returns at the start of a line,
+// and runs only the FOR or WHILE itself of a line that opens with one. So
+// it can't run a line of several statements holding a FOR or WHILE, a NEXT
+// or WEND after the first statement, or a GOSUB or ON ... GOSUB with more
+// statements after it. SELECT CASE is only resolved by the compiler, and
+// a BENCH in the program would start the benchmark over
+static int runs_line_by_line(void) {
+    for (int i = 0; i < prog_line_count(); i++) {
+        const ParsedLine *parsed = prog_parsed_at(i);
+        int shared = (parsed->stmt_count > 1);
+        for (int n = 0; n < parsed->stmt_count; n++) {
+            const Statement *st = &parsed->stmts[n];
+            int last = (n + 1 == parsed->stmt_count);
+            switch (st->tokens[0].type) {
+                case TOKEN_SELECT:
+                case TOKEN_CASE:
+                case TOKEN_BENCH:
+                    return 0;
+                case TOKEN_END:
+                    if (st->token_count >= 2) return 0;  // END SELECT
+                    break;
+                case TOKEN_FOR:
+                case TOKEN_WHILE:
+                    if (shared) return 0;
+                    break;
+                case TOKEN_NEXT:
+                case TOKEN_WEND:
+                    if (n > 0) return 0;
+                    break;
+                case TOKEN_GOSUB:
+                    if (!last) return 0;
+                    break;
+                case TOKEN_ON:
+                    if (!last && st->token_count >= 3 && st->tokens[2].type == TOKEN_GOSUB) return 0;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    return 1;
+}
+
+// Run the program through both engines and compare how long each takes
+static void run_bench(void) {
+    if (!runs_line_by_line()) {
+        printf("Line by line: can't run BENCH, SELECT CASE, or loops or GOSUB sharing a line with other statements\n");
+        return;
+    }
+    var_init();
+    loop_init();
+    data_seek(0);
+    uint64_t start = time_us_64();
+    uint32_t line_runs = run_lines();
+    uint64_t line_us = time_us_64() - start;
+    
+    var_init();
+    start = time_us_64();
+    uint32_t vm_instrs = vm_run();
+    uint64_t vm_us = time_us_64() - start;
+    
+    // The engines count different units (lines run, VM instructions after
+    // fusion), so only the times of the same program are compared
+    if (vm_us == 0) vm_us = 1;
+    printf("Line by line: %llu us (%lu lines run)\n", (unsigned long long)line_us, (unsigned long)line_runs);
+    printf("Bytecode:     %llu us (%lu instrs)\n", (unsigned long long)vm_us, (unsigned long)vm_instrs);
+    uint64_t tenths = line_us * 10 / vm_us;
+    printf("Speedup: %llu.%llux\n", (unsigned long long)(tenths / 10), (unsigned long long)(tenths % 10));
+}
+
+// Run the program on the bytecode engine without and with the optimizer
+static void run_optimize_bench(void) {
+    uint64_t us[2];
+    uint32_t stmts[2];
+    for (int optimized = 0; optimized <= 1; optimized++) {
+        compile_set_optimize(optimized);
+        var_init();
+        uint64_t start = time_us_64();
+        stmts[optimized] = vm_run();
+        us[optimized] = time_us_64() - start;
+        if (us[optimized] == 0) us[optimized] = 1;
+    }
+    
+    printf("Unoptimized: %lu instrs in %llu us\n", (unsigned long)stmts[0], (unsigned long long)us[0]);
+    printf("Optimized:   %lu instrs in %llu us\n", (unsigned long)stmts[1], (unsigned long long)us[1]);
+    uint64_t tenths = us[0] * 10 / us[1];
+    printf("Speedup: %llu.%llux\n", (unsigned long long)(tenths / 10), (unsigned long long)(tenths % 10));
+}
+
+#define DISPATCH_BENCH_LENGTH 1000
+#define DISPATCH_BENCH_ROUNDS 1000
+
+// Measure the VM's cost per instruction: dispatching no-ops alone, and the
+// average over the stored program
+static void run_dispatch_bench(void) {
+    Instr *code = calloc(DISPATCH_BENCH_LENGTH + 1, sizeof(Instr));
+    if (!code) {
+        printf("?OUT OF MEMORY\n");
+        return;
+    }
+    for (int i = 0; i < DISPATCH_BENCH_LENGTH; i++) {
+        code[i].op = OP_REM;
+    }
+    code[DISPATCH_BENCH_LENGTH].op = OP_END;
+    
+    uint32_t dispatched = 0;
+    uint64_t start = time_us_64();
+    for (int round = 0; round < DISPATCH_BENCH_ROUNDS; round++) {
+        dispatched += vm_run_code(code, DISPATCH_BENCH_LENGTH + 1);
+    }
+    uint64_t nop_us = time_us_64() - start;
+    free(code);
+    uint64_t tenths_ns = nop_us * 10000 / dispatched;
+    printf("Dispatch (%s): %llu.%llu ns per instruction\n", vm_dispatch_name(),
+           (unsigned long long)(tenths_ns / 10), (unsigned long long)(tenths_ns % 10));
+    
+    if (prog_line_count() > 0) {
+        var_init();
+        start = time_us_64();
+        uint32_t executed = vm_run();
+        uint64_t us = time_us_64() - start;
+        if (executed > 0) {
+            printf("Program: %lu instrs in %llu us, %llu ns per instruction\n", (unsigned long)executed,
+                   (unsigned long long)us, (unsigned long long)(us * 1000 / executed));
+        }
+    }
+}
+
+#define KEYWORD_BENCH_ROUNDS 10000
+
+// Reference for BENCH KEYWORDS: what tokenize() used to do per line
+// (copy, uppercase, then strncmp down the keyword list in order)
+static int keyword_chain_lookup(const char *line) {
+    char command[256];
+    strcpy(command, line);
+    for (char *c = command; *c; c++) {
+        *c = toupper((unsigned char)*c);
+    }
+    for (int i = 0; i < keyword_count(); i++) {
+        const char *name = keyword_name(i);
+        if (strncmp(command, name, strlen(name)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Time keyword classification for every keyword, hashed vs linear chain
+static void run_keyword_bench(void) {
+    volatile int sink = 0;
+    char line[32];
+    
+    printf("Keyword   Hash ns  Chain ns\n");
+    for (int i = 0; i < keyword_count(); i++) {
+        snprintf(line, sizeof(line), "%s x=1", keyword_name(i));
+        int len;
+        
+        uint64_t start = time_us_64();
+        for (int r = 0; r < KEYWORD_BENCH_ROUNDS; r++) {
+            sink += keyword_lookup(line, &len);
+        }
+        uint64_t hash_us = time_us_64() - start;
+        
+        start = time_us_64();
+        for (int r = 0; r < KEYWORD_BENCH_ROUNDS; r++) {
+            sink += keyword_chain_lookup(line);
+        }
+        uint64_t chain_us = time_us_64() - start;
+        
+        printf("%-8s %8llu %9llu\n", keyword_name(i),
+               (unsigned long long)(hash_us * 1000 / KEYWORD_BENCH_ROUNDS),
+               (unsigned long long)(chain_us * 1000 / KEYWORD_BENCH_ROUNDS));
+    }
+    (void)sink;
+}
+
+int execute(const char *line, const Token *tokens, int token_count, int line_num) {
     if (token_count == 0) return -1;
     
+    // Arguments that don't run to the end of the line are copied here
+    char buf[MAX_LINE_LENGTH];
+    
     switch (tokens[0].type) {
         case TOKEN_PRINT:
-            execute_print(tokens, token_count);
+            execute_print(line, tokens, token_count);
             break;
         case TOKEN_LET:
-            execute_let(tokens, token_count);
+            execute_let(line, tokens, token_count);
             break;
         case TOKEN_IF:
-            execute_if(tokens, token_count);
-            break;
+            return execute_if(line, tokens, token_count, line_num);
         case TOKEN_INPUT:
-            execute_input(tokens, token_count);
+            execute_input(line, tokens, token_count);
             break;
         case TOKEN_REM:
             // Comments do nothing
             break;
         case TOKEN_FOR:
-            // FOR i=1 TO 10
-            // tokens[1].value has the full expression "i=1"
+            // FOR i=1 TO 10 STEP 2
+            // tokens[1] has the full expression "i=1"
             // tokens[2] is TO
-            // tokens[3].value is the end value
+            // tokens[3] is the end value
+            // tokens[4] and tokens[5] are STEP and its value, if given
             if (token_count >= 4) {
                 char var_name[50];
-                int start_val, end_val;
+                char limit[MAX_LINE_LENGTH];
+                const char *p = token_text(line, &tokens[1], buf, sizeof(buf));
+                int32_t start_val, end_val, step = 1;
                 
-                // Parse "i=1" from tokens[1].value
-                const char *eq = strchr(tokens[1].value, '=');
-                if (eq) {
-                    strncpy(var_name, tokens[1].value, eq - tokens[1].value);
-                    var_name[eq - tokens[1].value] = '\0';
-                    start_val = atoi(eq + 1);
-                    end_val = atoi(tokens[3].value);
-                    
-                    loop_push_for(var_name, start_val, end_val, line_num);
+                // Parse "i=1" from tokens[1]
+                if (expr_parse_name(&p, var_name, sizeof(var_name)) != 0 || *p != '=') {
+                    printf("?SYNTAX ERROR\n");
+                    break;
+                }
+                int slot = var_slot(var_name);
+                if (slot < 0) {
+                    printf("?TOO MANY VARIABLES\n");
+                    break;
+                }
+                if (eval_number(p + 1, &start_val) == 0 &&
+                    eval_number(token_text(line, &tokens[3], limit, sizeof(limit)), &end_val) == 0 &&
+                    (token_count < 6 || eval_number(token_text(line, &tokens[5], limit, sizeof(limit)), &step) == 0)) {
+                    loop_push_for(slot, start_val, end_val, step, line_num);
                 }
             }
             break;
         case TOKEN_NEXT:
             // NEXT or NEXT i
             {
-                int jump_line = loop_for_next();
+                int slot = -1;
+                if (token_count >= 2) {
+                    char var_name[50];
+                    const char *p = token_text(line, &tokens[1], buf, sizeof(buf));
+                    if (expr_parse_name(&p, var_name, sizeof(var_name)) != 0 || *p != '\0') {
+                        printf("?SYNTAX ERROR\n");
+                        break;
+                    }
+                    slot = var_slot(var_name);
+                }
+                int jump_line = loop_for_next(slot);
                 if (jump_line >= 0) {
                     return jump_line;  // Jump back to FOR line
                 }
@@ -361,7 +1010,7 @@ int execute(Token* tokens, int token_count, int line_num) {
             break;
         case TOKEN_WHILE:
             // WHILE condition
-            // tokens[1].value has the condition
+            // tokens[1] has the condition
             if (token_count >= 2) {
                 loop_push_while(line_num);
             }
@@ -371,19 +1020,13 @@ int execute(Token* tokens, int token_count, int line_num) {
             {
                 int while_line = loop_get_start_line();
                 if (while_line >= 0) {
-                    // Get the WHILE line and evaluate its condition
-                    const char *while_text = prog_get_line(while_line);
-                    if (while_text) {
-                        int tc;
-                        Token* while_toks = tokenize(while_text, &tc);
-                        if (tc >= 2 && while_toks[0].type == TOKEN_WHILE) {
-                            // Evaluate the condition in while_toks[1].value
-                            if (evaluate_condition(while_toks[1].value)) {
-                                free_tokens(while_toks);
-                                return while_line;  // Jump back to WHILE
-                            }
+                    // Evaluate the WHILE line's condition from its stored tokens
+                    const ParsedLine *while_parsed = prog_get_parsed(while_line);
+                    const Statement *while_st = (while_parsed && while_parsed->stmt_count > 0) ? &while_parsed->stmts[0] : NULL;
+                    if (while_st && while_st->token_count >= 2 && while_st->tokens[0].type == TOKEN_WHILE) {
+                        if (evaluate_condition(token_text(while_parsed->text, &while_st->tokens[1], buf, sizeof(buf)))) {
+                            return while_line;  // Jump back to WHILE
                         }
-                        free_tokens(while_toks);
                     }
                 }
                 loop_pop();  // Exit the WHILE loop
@@ -393,78 +1036,20 @@ int execute(Token* tokens, int token_count, int line_num) {
             prog_list();
             break;
         case TOKEN_RUN:
-            {
-                int run_line = prog_first_line();
-                while (run_line >= 0) {
-                    // Check for Ctrl-C interrupt
-                    if (should_stop_execution()) {
-                        printf("BREAK\n");
-                        break;  // Exit RUN loop
-                    }
-                    
-                    const char *line_text = prog_get_line(run_line);
-                    if (line_text) {
-                        int tc;
-                            Token* toks = tokenize(line_text, &tc);
-                        
-                        // Special handling for FOR and WHILE loops
-                        if (tc > 0 && toks[0].type == TOKEN_FOR) {
-                            // Execute FOR to set up the loop, but pass next line as body start
-                            int next_line_for_body = prog_next_line(run_line);
-                            execute(toks, tc, next_line_for_body);
-                            free_tokens(toks);
-                            run_line = prog_next_line(run_line);
-                            goto continue_run;
-                        }
-                        if (tc > 0 && toks[0].type == TOKEN_WHILE) {
-                            // Save condition and execute WHILE to push onto stack
-                            char condition[256];
-                            strcpy(condition, toks[1].value);
-                            
-                            execute(toks, tc, run_line);
-                            free_tokens(toks);
-                            
-                            // Evaluate condition
-                            if (!evaluate_condition(condition)) {
-                                // Condition false, skip to line after WEND
-                                int skip_line = run_line;
-                                while ((skip_line = prog_next_line(skip_line)) >= 0) {
-                                    const char *skip_text = prog_get_line(skip_line);
-                                    if (skip_text) {
-                                        int skip_tc;
-                                        Token* skip_toks = tokenize(skip_text, &skip_tc);
-                                        if (skip_tc > 0 && skip_toks[0].type == TOKEN_WEND) {
-                                            free_tokens(skip_toks);
-                                            loop_pop();
-                                            run_line = prog_next_line(skip_line);
-                                            goto continue_run;
-                                        }
-                                        free_tokens(skip_toks);
-                                    }
-                                }
-                                loop_pop();
-                                run_line = prog_next_line(run_line);
-                                goto continue_run;
-                            }
-                            // Condition true, enter loop body
-                            run_line = prog_next_line(run_line);
-                            goto continue_run;
-                        }
-                        int next_line = execute(toks, tc, run_line);
-                        free_tokens(toks);
-                        if (next_line == -2) {
-                            // END statement - terminate program execution
-                            break;
-                        } else if (next_line >= 0) {
-                            run_line = next_line;  // Jump to specified line
-                        } else {
-                            run_line = prog_next_line(run_line);  // Continue sequentially
-                        }
-                        continue_run:;
-                    } else {
-                        run_line = prog_next_line(run_line);
-                    }
-                }
+            var_init();  // A program starts without variables or arrays
+            vm_run();
+            break;
+        case TOKEN_BENCH:
+            if (token_count < 2) {
+                run_bench();
+            } else if (strcasecmp(token_text(line, &tokens[1], buf, sizeof(buf)), "KEYWORDS") == 0) {
+                run_keyword_bench();
+            } else if (strcasecmp(token_text(line, &tokens[1], buf, sizeof(buf)), "OPTIMIZE") == 0) {
+                run_optimize_bench();
+            } else if (strcasecmp(token_text(line, &tokens[1], buf, sizeof(buf)), "DISPATCH") == 0) {
+                run_dispatch_bench();
+            } else {
+                printf("?UNKNOWN BENCHMARK\n");
             }
             break;
         case TOKEN_NEW:
@@ -473,36 +1058,36 @@ int execute(Token* tokens, int token_count, int line_num) {
             break;
         case TOKEN_SAVE:
             if (token_count >= 2) {
-                fs_save(tokens[1].value);
+                fs_save(token_text(line, &tokens[1], buf, sizeof(buf)));
             } else {
                 printf("?FILENAME REQUIRED\n");
             }
             break;
         case TOKEN_LOAD:
             if (token_count >= 2) {
-                fs_load(tokens[1].value);
+                fs_load(token_text(line, &tokens[1], buf, sizeof(buf)));
             } else {
                 printf("?FILENAME REQUIRED\n");
             }
             break;
         case TOKEN_DIR:
             if (token_count >= 2) {
-                fs_dir(tokens[1].value);
+                fs_dir(token_text(line, &tokens[1], buf, sizeof(buf)));
             } else {
                 fs_dir(NULL);
             }
             break;
         case TOKEN_RM:
             if (token_count >= 2) {
-                fs_rm(tokens[1].value);
+                fs_rm(token_text(line, &tokens[1], buf, sizeof(buf)));
             } else {
                 printf("?FILENAME REQUIRED\n");
             }
             break;
         case TOKEN_FORMAT:
-            if (token_count >= 3 && strcmp(tokens[2].value, "YES") == 0) {
+            if (token_count >= 3 && token_equals(line, &tokens[2], "YES")) {
                 // Parse drive number from "0:" or "1:"
-                uint8_t drive = tokens[1].value[0] - '0';
+                uint8_t drive = line[tokens[1].start] - '0';
                 fs_format(drive);
             } else {
                 printf("?FORMAT requires drive and YES confirmation\n");
@@ -511,7 +1096,7 @@ int execute(Token* tokens, int token_count, int line_num) {
             break;
         case TOKEN_CD:
             if (token_count >= 2) {
-                fs_cd(tokens[1].value);
+                fs_cd(token_text(line, &tokens[1], buf, sizeof(buf)));
             } else {
                 printf("?PATH REQUIRED\n");
             }
@@ -521,14 +1106,14 @@ int execute(Token* tokens, int token_count, int line_num) {
             break;
         case TOKEN_MKDIR:
             if (token_count >= 2) {
-                fs_mkdir(tokens[1].value);
+                fs_mkdir(token_text(line, &tokens[1], buf, sizeof(buf)));
             } else {
                 printf("?DIRECTORY NAME REQUIRED\n");
             }
             break;
         case TOKEN_RMDIR:
             if (token_count >= 2) {
-                fs_rmdir(tokens[1].value);
+                fs_rmdir(token_text(line, &tokens[1], buf, sizeof(buf)));
             } else {
                 printf("?DIRECTORY NAME REQUIRED\n");
             }
@@ -549,7 +1134,7 @@ int execute(Token* tokens, int token_count, int line_num) {
                 break;
             }
             
-            int target_line = atoi(tokens[1].value);
+            int target_line = atoi(line + tokens[1].start);
             if (target_line <= 0) {
                 printf("?INVALID LINE NUMBER\n");
                 break;
@@ -564,7 +1149,9 @@ int execute(Token* tokens, int token_count, int line_num) {
             }
             
             // Push return address and jump to target
-            gosub_push_return(return_addr);
+            if (gosub_push_return(return_addr) != 0) {
+                break;
+            }
             return target_line;  // Jump to GOSUB target
             break;
         }
@@ -575,7 +1162,7 @@ int execute(Token* tokens, int token_count, int line_num) {
                 break;
             }
             
-            int target_line = atoi(tokens[1].value);
+            int target_line = atoi(line + tokens[1].start);
             
             // Validate target line exists
             if (prog_get_line(target_line) == NULL) {
@@ -598,10 +1185,106 @@ int execute(Token* tokens, int token_count, int line_num) {
             break;
         }
         case TOKEN_END: {
-            // END - terminate program execution
+            // END - terminate program execution. END SELECT only closes a
+            // block, which compiled programs handle
+            if (token_count >= 2) {
+                break;
+            }
             return -2;  // Special return code to signal end of program
             break;
         }
+        case TOKEN_ON: {
+            // ON expr GOTO|GOSUB line, line, ...: out of range falls through
+            int targets[MAX_JUMP_LIST];
+            if (token_count < 4) {
+                printf("?SYNTAX ERROR\n");
+                break;
+            }
+            int count = parse_line_list(token_text(line, &tokens[3], buf, sizeof(buf)), targets, MAX_JUMP_LIST);
+            Expr *expr = expr_compile(token_text(line, &tokens[1], buf, sizeof(buf)));
+            int32_t value;
+            if (count < 0 || !expr) {
+                printf("%s\n", count < 0 ? "?SYNTAX ERROR" : expr_error());
+                expr_free(expr);
+                break;
+            }
+            int failed = expr_eval_number(expr, &value);
+            expr_free(expr);
+            if (failed || value < 1 || value > count) {
+                break;
+            }
+            
+            int target_line = targets[value - 1];
+            if (prog_get_line(target_line) == NULL) {
+                printf("?UNDEF'D STATEMENT %d\n", target_line);
+                break;
+            }
+            if (tokens[2].type == TOKEN_GOSUB) {
+                int return_addr = prog_next_line(line_num);
+                if (return_addr <= 0) {
+                    printf("?NO RETURN ADDRESS\n");
+                    break;
+                }
+                if (gosub_push_return(return_addr) != 0) {
+                    break;
+                }
+            }
+            return target_line;
+        }
+        case TOKEN_DEF:
+            if (token_count < 2 || expr_define_function(token_text(line, &tokens[1], buf, sizeof(buf))) != 0) {
+                printf("%s\n", token_count < 2 ? "?SYNTAX ERROR" : expr_error());
+            }
+            break;
+        case TOKEN_DIM:
+            if (token_count < 2) {
+                printf("?SYNTAX ERROR\n");
+            } else {
+                execute_dim(token_text(line, &tokens[1], buf, sizeof(buf)));
+            }
+            break;
+        case TOKEN_MEM:
+            execute_mem();
+            break;
+        case TOKEN_MAT:
+            if (token_count < 2) {
+                printf("?SYNTAX ERROR\n");
+            } else {
+                execute_mat(token_text(line, &tokens[1], buf, sizeof(buf)));
+            }
+            break;
+        case TOKEN_DATA:
+            // Read through the pool built when the line was stored
+            break;
+        case TOKEN_READ:
+            if (token_count < 2) {
+                printf("?SYNTAX ERROR\n");
+            } else {
+                execute_read(token_text(line, &tokens[1], buf, sizeof(buf)));
+            }
+            break;
+        case TOKEN_RESTORE:
+            execute_restore(token_count < 2 ? NULL : token_text(line, &tokens[1], buf, sizeof(buf)));
+            break;
+        case TOKEN_SORT:
+            if (token_count < 2) {
+                printf("?SYNTAX ERROR\n");
+            } else {
+                execute_sort(token_text(line, &tokens[1], buf, sizeof(buf)));
+            }
+            break;
+        case TOKEN_SEARCH:
+            if (token_count < 2) {
+                printf("?SYNTAX ERROR\n");
+            } else {
+                execute_search(token_text(line, &tokens[1], buf, sizeof(buf)));
+            }
+            break;
+        case TOKEN_SELECT:
+        case TOKEN_CASE:
+            // Blocks are resolved when a program is compiled
+            printf("?ILLEGAL DIRECT ERROR\n");
+            break;
         case TOKEN_NOTE: {
             // NOTE filename text - save text to filename.txt
             if (token_count < 2) {
@@ -611,10 +1294,10 @@ int execute(Token* tokens, int token_count, int line_num) {
             
             // Build filename with .txt extension
             char filename[128];
-            snprintf(filename, sizeof(filename), "%s.txt", tokens[1].value);
+            snprintf(filename, sizeof(filename), "%.*s.txt", tokens[1].length, line + tokens[1].start);
             
             // Get text content (token[2] if exists, otherwise empty)
-            const char *text = (token_count >= 3) ? tokens[2].value : "";
+            const char *text = (token_count >= 3) ? token_text(line, &tokens[2], buf, sizeof(buf)) : "";
             
             // Save to file
             fs_write_note(filename, text);
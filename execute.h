@@ -2,14 +2,26 @@
 #define EXECUTE_H
 
 #include "token.h"
+#include "expr.h"
 
 // Global interrupt flag set by Ctrl-C
 extern volatile int execution_interrupted;
 
-// Execute a parsed token command
+// Execute a parsed token command; the tokens slice line
 // line_num: the current line number (or -1 if immediate mode)
 // Returns: the next line number to execute (or -1 to continue sequentially)
-int execute(Token* tokens, int token_count, int line_num);
+int execute(const char *line, const Token *tokens, int token_count, int line_num);
+
+// Execute an immediate-mode line, which may hold several statements
+// separated by ':'. Returns like execute()
+int execute_line(const char *line);
+
+// Evaluate a condition such as "x>5" or "name$=\"bob\""
+// Returns 1 if true, 0 if false
+int evaluate_condition(const char *condition);
+
+// Evaluate and print one PRINT item (no newline)
+void print_expr(const Expr *item);
 
 // Check if execution should be interrupted and clear the flag
 int should_stop_execution(void);
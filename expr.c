@@ -0,0 +1,940 @@
+#include "expr.h"
+#include "variables.h"
+#include "strheap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#define MAX_EXPR_ITEMS 128
+#define MAX_EXPR_POOL 256
+#define MAX_NAME 50
+#define MAX_FUNCTIONS 32
+#define MAX_PARAMS 8
+#define MAX_CALL_DEPTH 8
+#define MAX_STRING_TEMP 4096    // Strings built while evaluating one expression
+
+// Operand stack shared by an expression and the DEF FN calls it makes,
+// each call's frame starting above its arguments. Static rather than on
+// the C stack, which is only 2 KB on the device
+#define EVAL_STACK_SIZE (EXPR_STACK_SIZE * 4)
+static Value eval_stack[EVAL_STACK_SIZE];
+
+// Parser state, static so compiling doesn't cost stack space
+typedef struct {
+    const char *p;
+    ExprItem items[MAX_EXPR_ITEMS];
+    int count;
+    char pool[MAX_EXPR_POOL];
+    int pool_used;
+    int depth;          // Operand stack depth at this point
+    int max_depth;
+    int barrier;        // Items before this may be skipped by a jump, so they aren't folded
+    const char *error;  // NULL, or the message for the first error
+    const char (*params)[MAX_NAME];  // DEF FN parameters while compiling a body
+    int param_count;
+} Parser;
+
+// A DEF FN: its body reads the call's arguments as EXPR_ARG 0, 1, ...
+typedef struct {
+    char name[MAX_NAME];
+    int param_count;
+    Expr *body;         // NULL until its DEF has been compiled
+} Function;
+
+// LEN, LEFT$, ...: recognised when followed by '(' (a variable may share the name)
+typedef struct {
+    const char *name;
+    uint8_t op;
+    uint8_t min_args;
+    uint8_t max_args;
+} Builtin;
+
+static const Builtin builtins[] = {
+    {"LEN", EXPR_LEN, 1, 1},
+    {"LEFT$", EXPR_LEFT, 2, 2},
+    {"RIGHT$", EXPR_RIGHT, 2, 2},
+    {"MID$", EXPR_MID, 2, 3},
+    {"INSTR", EXPR_INSTR, 2, 3},
+};
+
+static Parser parser;
+static Function functions[MAX_FUNCTIONS];
+static int function_count = 0;
+static const char *last_error = "?SYNTAX ERROR";
+static int fold_constants = 1;
+static char string_temp[MAX_STRING_TEMP];
+static int temp_used = 0;   // Reset by each expr_eval
+
+static void parse_or(Parser *ps);
+static int eval_frame(const Expr *expr, const Value *args, int base, int depth, Value *result);
+
+// Find a function by name, reserving an entry if it's new. Returns -1 if full
+static int function_slot(const char *name) {
+    for (int i = 0; i < function_count; i++) {
+        if (strcmp(functions[i].name, name) == 0) {
+            return i;
+        }
+    }
+    if (function_count >= MAX_FUNCTIONS) {
+        return -1;
+    }
+    Function *fn = &functions[function_count];
+    strcpy(fn->name, name);
+    fn->param_count = 0;
+    fn->body = NULL;
+    return function_count++;
+}
+
+// Names starting with FN are function calls
+static int is_function_name(const char *name) {
+    return toupper((unsigned char)name[0]) == 'F' && toupper((unsigned char)name[1]) == 'N' && name[2] != '\0';
+}
+
+int expr_is_name_start(char c) {
+    return isalpha((unsigned char)c);
+}
+
+int expr_is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static void skip_spaces(Parser *ps) {
+    while (*ps->p == ' ' || *ps->p == '\t') {
+        ps->p++;
+    }
+}
+
+// Comparison result from cmp (<0, 0, >0)
+static int32_t compare_truth(uint8_t op, int cmp) {
+    switch (op) {
+        case EXPR_EQ: return cmp == 0;
+        case EXPR_NE: return cmp != 0;
+        case EXPR_LT: return cmp < 0;
+        case EXPR_GT: return cmp > 0;
+        case EXPR_LE: return cmp <= 0;
+        default:      return cmp >= 0;
+    }
+}
+
+// A binary operator on two numbers. Arithmetic wraps around: it's done
+// unsigned, where overflow is defined, and INT32_MIN / -1 (the one quotient
+// that doesn't fit) gives INT32_MIN, as it would wrapping, instead of trapping
+static int32_t numeric_op(uint8_t op, int32_t a, int32_t b) {
+    switch (op) {
+        case EXPR_ADD: return (int32_t)((uint32_t)a + (uint32_t)b);
+        case EXPR_SUB: return (int32_t)((uint32_t)a - (uint32_t)b);
+        case EXPR_MUL: return (int32_t)((uint32_t)a * (uint32_t)b);
+        case EXPR_DIV:
+            if (b == 0) return 0;
+            return (b == -1) ? (int32_t)(0u - (uint32_t)a) : a / b;
+        case EXPR_MOD:
+            if (b == 0 || b == -1) return 0;
+            return a % b;
+        default:       return compare_truth(op, (a > b) - (a < b));
+    }
+}
+
+// Unary minus, wrapping like numeric_op (-INT32_MIN is INT32_MIN)
+static int32_t negate(int32_t a) {
+    return (int32_t)(0u - (uint32_t)a);
+}
+
+// Replace an operator whose operands are all number literals (in postfix
+// they're the items just before it) with its result. Returns 1 if folded
+static int fold(Parser *ps, uint8_t op) {
+    if (!fold_constants) return 0;
+    
+    int operands = (op == EXPR_NEG || op == EXPR_NOT) ? 1 : (op >= EXPR_ADD) ? 2 : 0;
+    if (operands == 0 || ps->count - operands < ps->barrier) return 0;
+    
+    ExprItem *top = &ps->items[ps->count - 1];
+    if (operands == 1) {
+        if (top->op != EXPR_NUM) return 0;
+        top->arg = (op == EXPR_NEG) ? negate(top->arg) : !top->arg;
+        return 1;
+    }
+    if (top->op != EXPR_NUM || top[-1].op != EXPR_NUM) return 0;
+    top[-1].arg = numeric_op(op, top[-1].arg, top->arg);
+    ps->count--;
+    return 1;
+}
+
+static void emit(Parser *ps, uint8_t op, int32_t arg, int stack_effect) {
+    if (fold(ps, op)) {
+        ps->depth += stack_effect;
+        return;
+    }
+    if (ps->count >= MAX_EXPR_ITEMS) {
+        ps->error = "?EXPRESSION TOO COMPLEX";
+        return;
+    }
+    ps->items[ps->count].op = op;
+    ps->items[ps->count].arg = arg;
+    ps->count++;
+    ps->depth += stack_effect;
+    if (ps->depth > ps->max_depth) {
+        ps->max_depth = ps->depth;
+    }
+}
+
+// Copy text into the string pool, returning its offset
+static int32_t add_to_pool(Parser *ps, const char *text, int len) {
+    if (ps->pool_used + len + 1 > MAX_EXPR_POOL) {
+        ps->error = "?EXPRESSION TOO COMPLEX";
+        return 0;
+    }
+    int32_t offset = ps->pool_used;
+    memcpy(ps->pool + offset, text, len);
+    ps->pool[offset + len] = '\0';
+    ps->pool_used += len + 1;
+    return offset;
+}
+
+// Match a keyword operator such as MOD (case-insensitive, whole word)
+static int match_word(Parser *ps, const char *word) {
+    int len = strlen(word);
+    for (int i = 0; i < len; i++) {
+        if (toupper((unsigned char)ps->p[i]) != word[i]) return 0;
+    }
+    if (expr_is_name_char(ps->p[len])) return 0;
+    ps->p += len;
+    return 1;
+}
+
+static const Builtin* find_builtin(const char *name) {
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcasecmp(builtins[i].name, name) == 0) {
+            return &builtins[i];
+        }
+    }
+    return NULL;
+}
+
+// Parse "(arg, ...)" after a function name. Returns the argument count
+static int parse_args(Parser *ps) {
+    int argc = 0;
+    do {
+        ps->p++;
+        parse_or(ps);
+        skip_spaces(ps);
+        argc++;
+    } while (!ps->error && *ps->p == ',');
+    if (!ps->error && *ps->p != ')') {
+        ps->error = "?SYNTAX ERROR";
+    }
+    ps->p++;
+    return argc;
+}
+
+int32_t expr_parse_number(const char **text) {
+    uint32_t value = 0;
+    while (isdigit((unsigned char)**text)) {
+        value = value * 10 + (uint32_t)(**text - '0');
+        (*text)++;
+    }
+    return (int32_t)value;
+}
+
+static void parse_primary(Parser *ps) {
+    skip_spaces(ps);
+    char c = *ps->p;
+    
+    if (isdigit((unsigned char)c)) {
+        emit(ps, EXPR_NUM, expr_parse_number(&ps->p), 1);
+    } else if (c == '"') {
+        const char *start = ++ps->p;
+        while (*ps->p && *ps->p != '"') {
+            ps->p++;
+        }
+        if (*ps->p != '"') {
+            ps->error = "?SYNTAX ERROR";  // Missing closing quote
+            return;
+        }
+        emit(ps, EXPR_STR, add_to_pool(ps, start, ps->p - start), 1);
+        ps->p++;
+    } else if (expr_is_name_start(c)) {
+        // Variables are resolved to their slot now, not on every evaluation
+        char name[MAX_NAME];
+        if (expr_parse_name(&ps->p, name, sizeof(name)) != 0) {
+            ps->error = "?SYNTAX ERROR";
+            return;
+        }
+        const Builtin *builtin = find_builtin(name);
+        if (builtin && *ps->p == '(') {
+            int argc = parse_args(ps);
+            if (ps->error) return;
+            if (argc < builtin->min_args || argc > builtin->max_args) {
+                ps->error = "?SYNTAX ERROR";
+                return;
+            }
+            emit(ps, builtin->op, argc, 1 - argc);
+            return;
+        }
+        if (is_function_name(name)) {
+            // FNname or FNname(arg, ...); the function is found by index
+            // on each call, so it may be defined after this is compiled
+            int fn = function_slot(name);
+            if (fn < 0) {
+                ps->error = "?TOO MANY FUNCTIONS";
+                return;
+            }
+            int argc = 0;
+            if (*ps->p == '(') {
+                argc = parse_args(ps);
+                if (ps->error) return;
+            }
+            emit(ps, EXPR_CALL, (fn << 8) | argc, 1 - argc);
+            return;
+        }
+        if (*ps->p == '(') {
+            // Array element; the array's DIM is checked when it's read
+            int array = var_array_slot(name);
+            if (array < 0) {
+                ps->error = "?TOO MANY VARIABLES";
+                return;
+            }
+            int argc = parse_args(ps);
+            if (ps->error) return;
+            if (argc > MAX_ARRAY_DIMS) {
+                ps->error = "?SYNTAX ERROR";
+                return;
+            }
+            emit(ps, EXPR_ELEM, (array << 8) | argc, 1 - argc);
+            return;
+        }
+        for (int i = 0; i < ps->param_count; i++) {
+            if (strcmp(ps->params[i], name) == 0) {
+                emit(ps, EXPR_ARG, i, 1);
+                return;
+            }
+        }
+        int slot = var_slot(name);
+        if (slot < 0) {
+            ps->error = "?TOO MANY VARIABLES";
+            return;
+        }
+        emit(ps, name[strlen(name) - 1] == '$' ? EXPR_STRVAR : EXPR_VAR, slot, 1);
+    } else if (c == '(') {
+        ps->p++;
+        parse_or(ps);
+        skip_spaces(ps);
+        if (*ps->p != ')') {
+            ps->error = "?SYNTAX ERROR";
+            return;
+        }
+        ps->p++;
+    } else {
+        ps->error = "?SYNTAX ERROR";
+    }
+}
+
+static void parse_unary(Parser *ps) {
+    skip_spaces(ps);
+    if (*ps->p == '-') {
+        ps->p++;
+        parse_unary(ps);
+        emit(ps, EXPR_NEG, 0, 0);
+    } else if (*ps->p == '+') {
+        ps->p++;
+        parse_unary(ps);
+    } else {
+        parse_primary(ps);
+    }
+}
+
+static void parse_term(Parser *ps) {
+    parse_unary(ps);
+    while (!ps->error) {
+        skip_spaces(ps);
+        uint8_t op;
+        if (*ps->p == '*') { op = EXPR_MUL; ps->p++; }
+        else if (*ps->p == '/') { op = EXPR_DIV; ps->p++; }
+        else if (*ps->p == '%') { op = EXPR_MOD; ps->p++; }
+        else if (match_word(ps, "MOD")) { op = EXPR_MOD; }
+        else break;
+        parse_unary(ps);
+        emit(ps, op, 0, -1);
+    }
+}
+
+static void parse_sum(Parser *ps) {
+    parse_term(ps);
+    while (!ps->error) {
+        skip_spaces(ps);
+        uint8_t op;
+        if (*ps->p == '+') op = EXPR_ADD;
+        else if (*ps->p == '-') op = EXPR_SUB;
+        else break;
+        ps->p++;
+        parse_term(ps);
+        emit(ps, op, 0, -1);
+    }
+}
+
+static void parse_comparison(Parser *ps) {
+    parse_sum(ps);
+    while (!ps->error) {
+        skip_spaces(ps);
+        const char *p = ps->p;
+        uint8_t op;
+        int len = 2;
+        if (p[0] == '<' && p[1] == '>') op = EXPR_NE;
+        else if (p[0] == '<' && p[1] == '=') op = EXPR_LE;
+        else if (p[0] == '>' && p[1] == '=') op = EXPR_GE;
+        else if (p[0] == '=' && p[1] == '=') op = EXPR_EQ;
+        else if (p[0] == '<') { op = EXPR_LT; len = 1; }
+        else if (p[0] == '>') { op = EXPR_GT; len = 1; }
+        else if (p[0] == '=') { op = EXPR_EQ; len = 1; }
+        else break;
+        ps->p += len;
+        parse_sum(ps);
+        emit(ps, op, 0, -1);
+    }
+}
+
+// NOT binds looser than comparisons: NOT a=b is NOT (a=b)
+static void parse_not(Parser *ps) {
+    skip_spaces(ps);
+    if (match_word(ps, "NOT")) {
+        parse_not(ps);
+        emit(ps, EXPR_NOT, 0, 0);
+    } else {
+        parse_comparison(ps);
+    }
+}
+
+// AND and OR short-circuit: when the left side decides the result, a jump
+// skips the right side and leaves 0 (AND) or 1 (OR)
+static void parse_logic(Parser *ps, int is_or) {
+    if (is_or) {
+        parse_logic(ps, 0);
+    } else {
+        parse_not(ps);
+    }
+    while (!ps->error) {
+        skip_spaces(ps);
+        if (!match_word(ps, is_or ? "OR" : "AND")) break;
+        int jump = ps->count;
+        emit(ps, is_or ? EXPR_OR : EXPR_AND, 0, -1);
+        if (is_or) {
+            parse_logic(ps, 0);
+        } else {
+            parse_not(ps);
+        }
+        emit(ps, EXPR_BOOL, 0, 0);
+        if (ps->error) break;
+        ps->items[jump].arg = ps->count;
+        ps->barrier = ps->count;
+    }
+}
+
+static void parse_or(Parser *ps) {
+    parse_logic(ps, 1);
+}
+
+static void begin_parse(Parser *ps, const char *text) {
+    ps->p = text;
+    ps->count = 0;
+    ps->pool_used = 0;
+    ps->depth = 0;
+    ps->max_depth = 0;
+    ps->error = NULL;
+    ps->barrier = 0;
+}
+
+// Package what was parsed, advancing *text past it
+static Expr* finish_parse(Parser *ps, const char **text) {
+    if (ps->error) {
+        last_error = "?SYNTAX ERROR";
+        return NULL;
+    }
+    if (ps->max_depth > EXPR_STACK_SIZE) {
+        last_error = "?EXPRESSION TOO COMPLEX";
+        return NULL;
+    }
+    
+    // Items and pool go into one exactly-sized block
+    size_t items_size = sizeof(ExprItem) * ps->count;
+    Expr *expr = malloc(sizeof(Expr) + items_size + ps->pool_used);
+    if (!expr) {
+        last_error = "?OUT OF MEMORY";
+        return NULL;
+    }
+    expr->length = ps->count;
+    expr->depth = ps->max_depth;
+    memcpy(expr->items, ps->items, items_size);
+    memcpy((char *)(expr->items + ps->count), ps->pool, ps->pool_used);
+    
+    skip_spaces(ps);
+    *text = ps->p;
+    return expr;
+}
+
+Expr* expr_parse(const char **text) {
+    Parser *ps = &parser;
+    begin_parse(ps, *text);
+    parse_or(ps);
+    return finish_parse(ps, text);
+}
+
+Expr* expr_parse_element(const char **text, int array) {
+    Parser *ps = &parser;
+    begin_parse(ps, *text);
+    if (*ps->p != '(') {
+        ps->error = "?SYNTAX ERROR";
+    } else {
+        int argc = parse_args(ps);
+        if (argc > MAX_ARRAY_DIMS) {
+            ps->error = "?SYNTAX ERROR";
+        }
+        emit(ps, EXPR_INDEX, (array << 8) | argc, 1 - argc);
+    }
+    return finish_parse(ps, text);
+}
+
+Expr* expr_compile(const char *text) {
+    const char *p = text;
+    Expr *expr = expr_parse(&p);
+    if (expr && *p != '\0') {
+        last_error = "?SYNTAX ERROR";
+        expr_free(expr);
+        return NULL;
+    }
+    return expr;
+}
+
+int expr_define_function(const char *text) {
+    char name[MAX_NAME];
+    char params[MAX_PARAMS][MAX_NAME];
+    int param_count = 0;
+    last_error = "?SYNTAX ERROR";
+    
+    if (expr_parse_name(&text, name, sizeof(name)) != 0 || !is_function_name(name)) {
+        return -1;
+    }
+    if (*text == '(') {
+        text++;
+        while (1) {
+            if (param_count >= MAX_PARAMS ||
+                expr_parse_name(&text, params[param_count], MAX_NAME) != 0) {
+                return -1;
+            }
+            param_count++;
+            if (*text != ',') break;
+            text++;
+        }
+        if (*text++ != ')') {
+            return -1;
+        }
+        while (*text == ' ' || *text == '\t') text++;
+    }
+    if (*text != '=') {
+        return -1;
+    }
+    
+    int fn = function_slot(name);
+    if (fn < 0) {
+        last_error = "?TOO MANY FUNCTIONS";
+        return -1;
+    }
+    
+    // Compile the body with the parameters in scope
+    parser.params = (const char (*)[MAX_NAME])params;
+    parser.param_count = param_count;
+    Expr *body = expr_compile(text + 1);
+    parser.params = NULL;
+    parser.param_count = 0;
+    if (!body) {
+        return -1;
+    }
+    expr_free(functions[fn].body);
+    functions[fn].body = body;
+    functions[fn].param_count = param_count;
+    return 0;
+}
+
+void expr_clear_functions(void) {
+    for (int i = 0; i < function_count; i++) {
+        expr_free(functions[i].body);
+    }
+    function_count = 0;
+}
+
+int expr_compile_print_list(const char *text, Expr **items, int *newline) {
+    int count = 0;
+    *newline = 1;
+    
+    while (*text == ' ' || *text == '\t') text++;
+    while (*text != '\0') {
+        if (*text == ';') {
+            *newline = 0;
+            text++;
+            while (*text == ' ' || *text == '\t') text++;
+            continue;
+        }
+        if (count >= MAX_PRINT_ITEMS) {
+            last_error = "?TOO MANY ITEMS";
+            goto fail;
+        }
+        items[count] = expr_parse(&text);
+        if (!items[count]) goto fail;
+        count++;
+        *newline = 1;
+    }
+    return count;
+
+fail:
+    while (count > 0) {
+        expr_free(items[--count]);
+    }
+    return -1;
+}
+
+int expr_parse_name(const char **text, char *name, int size) {
+    const char *p = *text;
+    while (*p == ' ' || *p == '\t') p++;
+    if (!expr_is_name_start(*p)) return -1;
+    
+    const char *start = p;
+    while (expr_is_name_char(*p)) p++;
+    if (*p == '$') p++;
+    if (p - start >= size) return -1;
+    
+    memcpy(name, start, p - start);
+    name[p - start] = '\0';
+    while (*p == ' ' || *p == '\t') p++;
+    *text = p;
+    return 0;
+}
+
+const char* expr_error(void) {
+    return last_error;
+}
+
+void expr_free(Expr *expr) {
+    free(expr);
+}
+
+static const char* expr_pool(const Expr *expr) {
+    return (const char *)(expr->items + expr->length);
+}
+
+int expr_eval(const Expr *expr, Value *result) {
+    temp_used = 0;
+    return eval_frame(expr, NULL, 0, 0, result);
+}
+
+static int type_error(void) {
+    printf("?TYPE MISMATCH\n");
+    return -1;
+}
+
+static int illegal_call(void) {
+    printf("?ILLEGAL FUNCTION CALL\n");
+    return -1;
+}
+
+// Strings compare like strcmp, but by length instead of a terminator
+static int compare_strings(const Value *a, const Value *b) {
+    int n = a->len < b->len ? a->len : b->len;
+    int cmp = memcmp(a->str, b->str, n);
+    return cmp ? cmp : (a->len > b->len) - (a->len < b->len);
+}
+
+// a$+b$ into a: the result goes to the temporary space, unless one side is
+// empty. A chain a$+b$+c$ grows its result where it lies, so every piece
+// is copied once
+static int concat(Value *a, const Value *b) {
+    if (b->len == 0) return 0;
+    if (a->len == 0) {
+        *a = *b;
+        return 0;
+    }
+    int at_end = a->str >= string_temp && a->str + a->len == string_temp + temp_used;
+    int needed = at_end ? b->len : a->len + b->len;
+    if (temp_used + needed > MAX_STRING_TEMP) {
+        printf("?STRING TOO LONG\n");
+        return -1;
+    }
+    if (!at_end) {
+        memcpy(string_temp + temp_used, a->str, a->len);
+        a->str = string_temp + temp_used;
+        temp_used += a->len;
+    }
+    memcpy(string_temp + temp_used, b->str, b->len);
+    temp_used += b->len;
+    a->len += b->len;
+    a->in_heap = 0;
+    return 0;
+}
+
+// LEFT$(s$, n), RIGHT$(s$, n) or MID$(s$, start[, n]) applied to s, with
+// the numbers in args. Slices point into their source: nothing is copied
+static int slice(uint8_t op, Value *s, const Value *args, int count) {
+    if (!s->is_string || args[0].is_string || (count > 1 && args[1].is_string)) {
+        return type_error();
+    }
+    int32_t start = 0;
+    int32_t n = args[0].num;
+    if (op == EXPR_MID) {
+        start = args[0].num - 1;
+        n = (count > 1) ? args[1].num : s->len;
+        if (start < 0) return illegal_call();
+    }
+    if (n < 0) return illegal_call();
+    if (op == EXPR_RIGHT) {
+        start = (n < s->len) ? s->len - n : 0;
+    }
+    if (start > s->len) start = s->len;
+    if (n > s->len - start) n = s->len - start;
+    
+    if (start != 0 || n != s->len) {
+        s->in_heap = 0;
+    }
+    s->str += start;
+    s->len = n;
+    return 0;
+}
+
+// 1-based position of find in s at or after index from, or 0. memchr finds
+// candidates for the first character; only those are compared in full
+static int32_t find_string(const Value *s, const Value *find, int32_t from) {
+    if (from > s->len) return 0;
+    if (find->len == 0) return from + 1;
+    
+    int32_t last = s->len - find->len;  // Last index a match can start at
+    while (from <= last) {
+        const char *p = memchr(s->str + from, find->str[0], last - from + 1);
+        if (!p) return 0;
+        from = p - s->str;
+        if (memcmp(p + 1, find->str + 1, find->len - 1) == 0) {
+            return from + 1;
+        }
+        from++;
+    }
+    return 0;
+}
+
+// Evaluate expr with args as the arguments of the DEF FN call it's the
+// body of, on eval_stack from base up; depth counts nested calls
+static int eval_frame(const Expr *expr, const Value *args, int base, int depth, Value *result) {
+    if (base + expr->depth > EVAL_STACK_SIZE) {
+        printf("?NESTING TOO DEEP\n");
+        return -1;
+    }
+    Value *stack = &eval_stack[base];
+    int sp = 0;
+    const char *pool = expr_pool(expr);
+    
+    for (int i = 0; i < expr->length; i++) {
+        const ExprItem *item = &expr->items[i];
+        switch (item->op) {
+            case EXPR_NUM:
+                stack[sp].is_string = 0;
+                stack[sp].num = item->arg;
+                sp++;
+                break;
+            case EXPR_STR:
+                stack[sp].is_string = 1;
+                stack[sp].in_heap = 0;
+                stack[sp].str = pool + item->arg;
+                stack[sp].len = strlen(stack[sp].str);
+                sp++;
+                break;
+            case EXPR_VAR: {
+                // Undefined numeric variables read as 0
+                stack[sp].is_string = 0;
+                stack[sp].num = var_get_number_slot(item->arg);
+                sp++;
+                break;
+            }
+            case EXPR_STRVAR: {
+                stack[sp].is_string = 1;
+                stack[sp].str = var_get_string_slot(item->arg);
+                stack[sp].in_heap = strheap_contains(stack[sp].str);
+                stack[sp].len = stack[sp].in_heap ? strheap_length(stack[sp].str) : 0;
+                sp++;
+                break;
+            }
+            case EXPR_ARG:
+                stack[sp++] = args[item->arg];
+                break;
+            case EXPR_CALL: {
+                // Arguments are the top argc values; the result replaces them
+                const Function *fn = &functions[item->arg >> 8];
+                int argc = item->arg & 0xff;
+                if (!fn->body) {
+                    printf("?UNDEF'D FUNCTION %s\n", fn->name);
+                    return -1;
+                }
+                if (fn->param_count != argc) {
+                    printf("?SYNTAX ERROR\n");
+                    return -1;
+                }
+                if (depth >= MAX_CALL_DEPTH) {
+                    printf("?NESTING TOO DEEP\n");
+                    return -1;
+                }
+                sp -= argc;
+                if (eval_frame(fn->body, &stack[sp], base + sp + argc, depth + 1, &stack[sp]) != 0) {
+                    return -1;
+                }
+                sp++;
+                break;
+            }
+            case EXPR_ELEM:
+            case EXPR_INDEX: {
+                int argc = item->arg & 0xff;
+                int32_t subscripts[MAX_ARRAY_DIMS];
+                sp -= argc;
+                for (int k = 0; k < argc; k++) {
+                    if (stack[sp + k].is_string) goto type_mismatch;
+                    subscripts[k] = stack[sp + k].num;
+                }
+                int32_t index = var_array_index(item->arg >> 8, subscripts, argc);
+                if (index < 0) {
+                    return -1;
+                }
+                if (item->op == EXPR_ELEM) {
+                    var_array_get(item->arg >> 8, index, &stack[sp]);
+                } else {
+                    stack[sp].is_string = 0;
+                    stack[sp].num = index;
+                }
+                sp++;
+                break;
+            }
+            case EXPR_AND:
+            case EXPR_OR: {
+                Value *top = &stack[sp - 1];
+                if (top->is_string) goto type_mismatch;
+                if ((top->num != 0) == (item->op == EXPR_OR)) {
+                    // The left side decides: skip the right side
+                    top->num = (item->op == EXPR_OR);
+                    i = item->arg - 1;
+                } else {
+                    sp--;
+                }
+                break;
+            }
+            case EXPR_BOOL:
+            case EXPR_NOT:
+                if (stack[sp - 1].is_string) goto type_mismatch;
+                stack[sp - 1].num = (stack[sp - 1].num != 0) == (item->op == EXPR_BOOL);
+                break;
+            case EXPR_LEN:
+                if (!stack[sp - 1].is_string) goto type_mismatch;
+                stack[sp - 1].is_string = 0;
+                stack[sp - 1].num = stack[sp - 1].len;
+                break;
+            case EXPR_LEFT:
+            case EXPR_RIGHT:
+            case EXPR_MID:
+                sp -= item->arg - 1;
+                if (slice(item->op, &stack[sp - 1], &stack[sp], item->arg - 1) != 0) {
+                    return -1;
+                }
+                break;
+            case EXPR_INSTR: {
+                sp -= item->arg - 1;
+                Value *v = &stack[sp - 1];
+                int32_t start = 1;
+                if (item->arg == 3) {
+                    if (v->is_string) goto type_mismatch;
+                    start = v->num;
+                    v++;
+                }
+                if (!v[0].is_string || !v[1].is_string) goto type_mismatch;
+                if (start < 1) return illegal_call();
+                stack[sp - 1].num = find_string(&v[0], &v[1], start - 1);
+                stack[sp - 1].is_string = 0;
+                break;
+            }
+            case EXPR_NEG:
+                if (stack[sp - 1].is_string) goto type_mismatch;
+                stack[sp - 1].num = negate(stack[sp - 1].num);
+                break;
+            default: {
+                Value *a = &stack[sp - 2];
+                Value *b = &stack[sp - 1];
+                sp--;
+                
+                if (a->is_string || b->is_string) {
+                    // Strings can only be joined or compared, and only with strings
+                    if (!a->is_string || !b->is_string) goto type_mismatch;
+                    if (item->op == EXPR_ADD) {
+                        if (concat(a, b) != 0) return -1;
+                        break;
+                    }
+                    if (item->op < EXPR_EQ) goto type_mismatch;
+                    a->is_string = 0;
+                    a->num = compare_truth(item->op, compare_strings(a, b));
+                    break;
+                }
+                a->num = numeric_op(item->op, a->num, b->num);
+                break;
+            }
+        }
+    }
+    
+    *result = stack[0];
+    return 0;
+
+type_mismatch:
+    return type_error();
+}
+
+int expr_eval_number(const Expr *expr, int32_t *result) {
+    Value value;
+    if (expr_eval(expr, &value) != 0) return -1;
+    if (value.is_string) {
+        printf("?TYPE MISMATCH\n");
+        return -1;
+    }
+    *result = value.num;
+    return 0;
+}
+
+int expr_eval_condition(const Expr *expr) {
+    int32_t value;
+    if (expr_eval_number(expr, &value) != 0) return 0;
+    return value != 0;
+}
+
+void expr_set_folding(int enabled) {
+    fold_constants = enabled;
+}
+
+int expr_constant(const Expr *expr, int32_t *value) {
+    if (expr->length == 1 && expr->items[0].op == EXPR_NUM) {
+        *value = expr->items[0].arg;
+        return 1;
+    }
+    return 0;
+}
+
+int expr_increment(const Expr *expr, int slot, int32_t *amount) {
+    if (expr->length != 3) return 0;
+    const ExprItem *items = expr->items;
+    if (items[0].op == EXPR_VAR && items[0].arg == slot && items[1].op == EXPR_NUM) {
+        // v+k or v-k
+        if (items[2].op == EXPR_ADD) { *amount = items[1].arg; return 1; }
+        if (items[2].op == EXPR_SUB) { *amount = negate(items[1].arg); return 1; }
+    } else if (items[0].op == EXPR_NUM && items[1].op == EXPR_VAR && items[1].arg == slot &&
+               items[2].op == EXPR_ADD) {
+        // k+v
+        *amount = items[0].arg;
+        return 1;
+    }
+    return 0;
+}
+
+int expr_single_var(const Expr *expr) {
+    if (expr->length == 1 &&
+        (expr->items[0].op == EXPR_VAR || expr->items[0].op == EXPR_STRVAR)) {
+        return expr->items[0].arg;
+    }
+    return -1;
+}
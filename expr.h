@@ -0,0 +1,138 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stdint.h>
+
+// Maximum operand stack depth an expression may need
+#define EXPR_STACK_SIZE 32
+
+// Postfix (RPN) operations
+typedef enum {
+    EXPR_NUM,       // Push number arg
+    EXPR_STR,       // Push string literal at pool + arg
+    EXPR_VAR,       // Push numeric variable in slot arg
+    EXPR_STRVAR,    // Push string variable in slot arg
+    EXPR_ARG,       // Push argument arg of the DEF FN call being evaluated
+    EXPR_CALL,      // Call DEF FN arg >> 8 with the arg & 0xff values on top of the stack
+    EXPR_ELEM,      // Push element of array arg >> 8; the arg & 0xff subscripts are on the stack
+    EXPR_INDEX,     // As EXPR_ELEM, but push the element's position (assignment target)
+    EXPR_AND,       // If the top is false, make it 0 and jump to item arg; else pop it
+    EXPR_OR,        // If the top is true, make it 1 and jump to item arg; else pop it
+    EXPR_BOOL,      // Turn the top into 1 if true, 0 if false
+    EXPR_NOT,       // Logical not: 1 if the top is 0, else 0
+    EXPR_LEN,       // LEN(s$)
+    EXPR_LEFT,      // LEFT$(s$, n)
+    EXPR_RIGHT,     // RIGHT$(s$, n)
+    EXPR_MID,       // MID$(s$, start[, n]); arg is the argument count
+    EXPR_INSTR,     // INSTR([start,] s$, find$); arg is the argument count
+    EXPR_NEG,       // Unary minus
+    EXPR_ADD,       // Numbers are added, strings joined
+    EXPR_SUB,
+    EXPR_MUL,
+    EXPR_DIV,
+    EXPR_MOD,
+    EXPR_EQ,
+    EXPR_NE,
+    EXPR_LT,
+    EXPR_GT,
+    EXPR_LE,
+    EXPR_GE,
+} ExprOp;
+
+typedef struct {
+    uint8_t op;
+    int32_t arg;
+} ExprItem;
+
+// A compiled expression: items in postfix order followed by a string pool
+// holding its literals. Variables are referenced by slot (see var_slot).
+typedef struct {
+    int length;
+    int depth;              // Operand stack slots its evaluation needs
+    ExprItem items[];
+} Expr;
+
+// Result of evaluating an expression. Strings are slices: str need not end
+// in '\0', and may point into a variable's string, a literal or the
+// temporary space of the evaluation that produced it
+typedef struct {
+    uint8_t is_string;
+    uint8_t in_heap;        // str is a whole string-heap string, so it can be shared
+    int32_t num;
+    const char *str;
+    int32_t len;            // Length of str
+} Value;
+
+// Maximum number of items in one PRINT list
+#define MAX_PRINT_ITEMS 32
+
+// Compile the expression at the start of *text, stopping at the first
+// character or word that can't continue it (THEN, TO, ';', ...).
+// Advances *text past the expression. Returns NULL on error (see expr_error).
+Expr* expr_parse(const char **text);
+
+// Compile a complete expression; trailing text is a syntax error
+Expr* expr_compile(const char *text);
+
+// Compile the subscripts "(i, j)" at *text of the array in slot (see
+// var_array_slot) into an expression giving the element's position, for
+// assigning to it. Advances *text past them. Returns NULL on error
+Expr* expr_parse_element(const char **text, int array);
+
+// Compile a PRINT list: items separated by ';' or just spaces.
+// Stores up to MAX_PRINT_ITEMS expressions in items and sets *newline to 0
+// if the list ends with ';'. Returns the item count or -1 on error.
+int expr_compile_print_list(const char *text, Expr **items, int *newline);
+
+// Read the digits at *text as an integer literal, advancing past them.
+// Digits past the int32 range wrap, so -2147483648 can be written
+int32_t expr_parse_number(const char **text);
+
+// Parse a variable name (letters, digits, _ and optional $) into name
+// Returns 0 on success, -1 if *text doesn't start with a valid name
+int expr_parse_name(const char **text, char *name, int size);
+
+// Message for the last compile error, e.g. "?SYNTAX ERROR"
+const char* expr_error(void);
+
+// DEF FNname(a, b)=expression (text starts at FNname): compile the body,
+// with a and b bound to the call's arguments, and register it
+// Returns 0 on success, -1 on error (see expr_error)
+int expr_define_function(const char *text);
+
+// Forget every DEF FN, so a program starts without functions
+void expr_clear_functions(void);
+
+// Free a compiled expression
+void expr_free(Expr *expr);
+
+// Evaluate a compiled expression. A string result built by the evaluation
+// (a$+b$) stays valid until the next expr_eval
+// Returns 0 on success, -1 on error (message already printed)
+int expr_eval(const Expr *expr, Value *result);
+
+// Evaluate and require a number. Returns 0 on success, -1 on error
+int expr_eval_number(const Expr *expr, int32_t *result);
+
+// Evaluate as a condition: nonzero number is true, errors are false
+int expr_eval_condition(const Expr *expr);
+
+// Fold operators on number literals while compiling ("60*60*24" becomes
+// one literal). On by default; turned off to time unoptimized programs
+void expr_set_folding(int enabled);
+
+// If the expression is a single number literal, store it and return 1
+int expr_constant(const Expr *expr, int32_t *value);
+
+// If the expression is v+k, k+v or v-k for the numeric variable in slot,
+// store k (negated for v-k) and return 1
+int expr_increment(const Expr *expr, int slot, int32_t *amount);
+
+// If the expression is a single variable reference, return its slot (else -1)
+int expr_single_var(const Expr *expr);
+
+// Check if a character can start or continue a variable name
+int expr_is_name_start(char c);
+int expr_is_name_char(char c);
+
+#endif
@@ -338,20 +338,16 @@ int fs_save(const char *filename) {
     static char program_data[MAX_FILE_SIZE];
     int offset = 0;
     
-    int line_num = prog_first_line();
-    while (line_num >= 0) {
-        const char *line_text = prog_get_line(line_num);
-        if (line_text) {
-            int written = snprintf(program_data + offset, 
-                                  MAX_FILE_SIZE - offset,
-                                  "%d %s\n", line_num, line_text);
-            if (written < 0 || offset + written >= MAX_FILE_SIZE) {
-                printf("?PROGRAM TOO LARGE\n");
-                return -1;
-            }
-            offset += written;
+    // Straight out of the program arena, in line order
+    for (int i = 0; i < prog_line_count(); i++) {
+        int written = snprintf(program_data + offset, 
+                              MAX_FILE_SIZE - offset,
+                              "%d %s\n", prog_line_at(i), prog_text_at(i));
+        if (written < 0 || offset + written >= MAX_FILE_SIZE) {
+            printf("?PROGRAM TOO LARGE\n");
+            return -1;
         }
-        line_num = prog_next_line(line_num);
+        offset += written;
     }
     
     // Find or create file entry
@@ -525,8 +521,9 @@ int fs_load(const char *filename) {
     // Read file data from flash
     const uint8_t *file_data = get_flash_ptr() + entry->offset;
     
-    // Clear current program
+    // Clear current program and take the lines in one batch
     prog_clear();
+    prog_begin_load();
     
     // Parse and load lines
     char line_buffer[256];
@@ -548,6 +545,7 @@ int fs_load(const char *filename) {
         line_buffer[buf_pos] = '\0';
         prog_store_line(line_buffer);
     }
+    prog_end_load();
     
     printf("Loaded: %s (%d bytes)\n", full_path, entry->size);
     return 0;
@@ -14,37 +14,56 @@ typedef enum {
 
 typedef struct {
     LoopType type;
-    char var_name[50];  // FOR loop variable
-    int end_val;        // FOR loop end value
-    int start_line;     // Line number where loop starts
+    int var_slot;       // FOR loop variable
+    int32_t end_val;    // FOR loop end value
+    int32_t step;       // FOR loop increment (may be negative)
+    int start_line;     // Where the loop body starts (line number or pc)
 } LoopInfo;
 
 static LoopInfo loop_stack[MAX_LOOP_DEPTH];
 static int loop_depth = 0;
 
-// GOSUB/RETURN stack
+// GOSUB/RETURN stack of resolved return positions
 static int return_stack[MAX_GOSUB_DEPTH];
 static int return_depth = 0;
 
 void loop_init(void) {
     loop_depth = 0;
     memset(loop_stack, 0, sizeof(loop_stack));
+    return_depth = 0;
 }
 
-void loop_push_for(const char *var, int start_val, int end_val, int body_start_line) {
-    if (loop_depth < MAX_LOOP_DEPTH) {
-        loop_stack[loop_depth].type = LOOP_FOR;
-        strcpy(loop_stack[loop_depth].var_name, var);
-        loop_stack[loop_depth].end_val = end_val;
-        loop_stack[loop_depth].start_line = body_start_line;
-        
-        // Set the loop variable to start value
-        char assignment[100];
-        snprintf(assignment, sizeof(assignment), "%s=%d", var, start_val);
-        var_set(assignment);
-        
-        loop_depth++;
+// Innermost FOR frame for a variable, or -1
+static int find_for(int var_slot) {
+    for (int i = loop_depth - 1; i >= 0; i--) {
+        if (loop_stack[i].type == LOOP_FOR && loop_stack[i].var_slot == var_slot) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int loop_push_for(int var_slot, int32_t start_val, int32_t end_val, int32_t step, int body_start_line) {
+    // Re-entering FOR on the same variable restarts that loop and drops
+    // anything nested inside it, so jumping out of loops doesn't leak frames
+    int existing = find_for(var_slot);
+    if (existing >= 0) {
+        loop_depth = existing;
+    } else if (loop_depth >= MAX_LOOP_DEPTH) {
+        printf("?NESTING TOO DEEP\n");
+        return -1;
     }
+    
+    LoopInfo *loop = &loop_stack[loop_depth++];
+    loop->type = LOOP_FOR;
+    loop->var_slot = var_slot;
+    loop->end_val = end_val;
+    loop->step = step;
+    loop->start_line = body_start_line;
+    
+    // Set the loop variable to start value
+    var_set_number_slot(var_slot, start_val);
+    return 0;
 }
 
 void loop_push_while(int while_line) {
@@ -62,38 +81,37 @@ int loop_get_start_line(void) {
     return -1;
 }
 
+static int for_in_range(const LoopInfo *loop, int32_t value) {
+    return loop->step >= 0 ? value <= loop->end_val : value >= loop->end_val;
+}
+
 int loop_for_should_continue(void) {
     if (loop_depth > 0 && loop_stack[loop_depth - 1].type == LOOP_FOR) {
-        const char *var_name = loop_stack[loop_depth - 1].var_name;
-        const char *val_str = var_get(var_name);
-        if (val_str) {
-            int current = atoi(val_str);
-            return current <= loop_stack[loop_depth - 1].end_val;
-        }
+        const LoopInfo *loop = &loop_stack[loop_depth - 1];
+        return for_in_range(loop, var_get_number_slot(loop->var_slot));
     }
     return 0;
 }
 
-// Fix: Only pop FOR loop when end is exceeded
-int loop_for_next(void) {
-    if (loop_depth > 0 && loop_stack[loop_depth - 1].type == LOOP_FOR) {
-        const char *var_name = loop_stack[loop_depth - 1].var_name;
-        const char *val_str = var_get(var_name);
-        if (val_str) {
-            int current = atoi(val_str);
-            current++;
-            // Update variable
-            char assignment[100];
-            snprintf(assignment, sizeof(assignment), "%s=%d", var_name, current);
-            var_set(assignment);
-            if (current <= loop_stack[loop_depth - 1].end_val) {
-                return loop_stack[loop_depth - 1].start_line; // Continue loop
-            } else {
-                loop_pop(); // Only pop when done
-            }
-        }
+int loop_for_next(int var_slot) {
+    // NEXT i closes the loop on i (and any left open inside it); plain NEXT the innermost
+    int index = (var_slot >= 0) ? find_for(var_slot) : loop_depth - 1;
+    if (index < 0 || loop_stack[index].type != LOOP_FOR) {
+        printf("?NEXT WITHOUT FOR\n");
+        return -2;
+    }
+    loop_depth = index + 1;
+    
+    const LoopInfo *loop = &loop_stack[index];
+    // A step past the int32 range has also gone past the limit; the counter
+    // is left wrapped, like any other overflowing addition
+    int64_t value = (int64_t)var_get_number_slot(loop->var_slot) + loop->step;
+    var_set_number_slot(loop->var_slot, (int32_t)(uint32_t)value);
+    if (value >= INT32_MIN && value <= INT32_MAX && for_in_range(loop, (int32_t)value)) {
+        return loop->start_line;  // Continue loop
     }
-    return -1; // No jump, continue sequentially
+    loop_pop();  // Only pop when done
+    return -1;
 }
 
 void loop_pop(void) {
@@ -116,12 +134,13 @@ void loop_wend_check_pop(int condition) {
 }
 
 // GOSUB/RETURN stack operations
-void gosub_push_return(int return_line) {
+int gosub_push_return(int return_pos) {
     if (return_depth < MAX_GOSUB_DEPTH) {
-        return_stack[return_depth++] = return_line;
-    } else {
-        printf("?GOSUB STACK OVERFLOW\n");
+        return_stack[return_depth++] = return_pos;
+        return 0;
     }
+    printf("?GOSUB STACK OVERFLOW\n");
+    return -1;
 }
 
 int gosub_pop_return(void) {
@@ -1,11 +1,15 @@
 #ifndef LOOPS_H
 #define LOOPS_H
 
-// Initialize loop stack
+#include <stdint.h>
+
+// Initialize loop stack and GOSUB return stack
 void loop_init(void);
 
-// Push a FOR loop onto the stack
-void loop_push_for(const char *var, int start_val, int end_val, int body_start_line);
+// Push a FOR loop onto the stack (var_slot from var_slot()) and set the
+// variable to start_val. A FOR on a variable that already has a frame
+// restarts that frame. Returns -1 if the stack is full (message printed)
+int loop_push_for(int var_slot, int32_t start_val, int32_t end_val, int32_t step, int body_start_line);
 
 // Push a WHILE loop onto the stack
 void loop_push_while(int while_line);
@@ -16,8 +20,10 @@ int loop_get_start_line(void);
 // Check if current FOR loop should continue
 int loop_for_should_continue(void);
 
-// Increment the FOR loop variable and check if done
-int loop_for_next(void);
+// NEXT: step the FOR loop on var_slot (-1 for the innermost loop)
+// Returns where its body starts if the loop continues, -1 once it's done,
+// or -2 if there's no such loop (message printed)
+int loop_for_next(int var_slot);
 
 // Pop the top loop off the stack
 void loop_pop(void);
@@ -25,8 +31,10 @@ void loop_pop(void);
 // Check if there are any active loops
 int loop_has_active(void);
 
-// GOSUB/RETURN stack operations
-void gosub_push_return(int return_line);
+// GOSUB/RETURN stack operations. Return positions are instruction indices
+// when running compiled code (line numbers on the line-by-line BENCH path)
+// gosub_push_return returns -1 on overflow (message already printed)
+int gosub_push_return(int return_pos);
 int gosub_pop_return(void);
 int gosub_has_return(void);
 
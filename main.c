@@ -109,11 +109,8 @@ int main() {
                     // Store it in the program
                     prog_store_line(cmd);
                 } else {
-                    // Execute immediately
-                    int token_count;
-                    Token* tokens = tokenize(cmd, &token_count);
-                    execute(tokens, token_count, -1);  // -1 = immediate mode
-                    free_tokens(tokens);
+                    // Execute immediately (statements may be separated by ':')
+                    execute_line(cmd);
                 }
             }
         }
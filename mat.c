@@ -0,0 +1,97 @@
+#include "mat.h"
+#include <string.h>
+
+// The Cortex-M33's packed DSP instructions work on 8- and 16-bit lanes, and
+// array elements are 32 bits wide, so there's no packed form of these
+// kernels. They're plain loops over contiguous memory instead: host
+// compilers vectorize them, and the reductions keep four independent
+// accumulators so an in-order core isn't waiting on a single add chain.
+// Wrapping arithmetic is done unsigned, where overflow is defined
+
+void mat_copy(int32_t *dst, const int32_t *a, int32_t n) {
+    if (dst != a) {
+        memcpy(dst, a, sizeof(int32_t) * n);
+    }
+}
+
+void mat_add(int32_t *dst, const int32_t *a, const int32_t *b, int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        dst[i] = (int32_t)((uint32_t)a[i] + (uint32_t)b[i]);
+    }
+}
+
+void mat_sub(int32_t *dst, const int32_t *a, const int32_t *b, int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        dst[i] = (int32_t)((uint32_t)a[i] - (uint32_t)b[i]);
+    }
+}
+
+void mat_scale(int32_t *dst, const int32_t *a, int32_t k, int32_t n) {
+    for (int32_t i = 0; i < n; i++) {
+        dst[i] = (int32_t)((uint32_t)a[i] * (uint32_t)k);
+    }
+}
+
+int32_t mat_sum(const int32_t *a, int32_t n) {
+    uint32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += (uint32_t)a[i];
+        s1 += (uint32_t)a[i + 1];
+        s2 += (uint32_t)a[i + 2];
+        s3 += (uint32_t)a[i + 3];
+    }
+    for (; i < n; i++) {
+        s0 += (uint32_t)a[i];
+    }
+    return (int32_t)(s0 + s1 + s2 + s3);
+}
+
+int32_t mat_min(const int32_t *a, int32_t n) {
+    int32_t m0 = a[0], m1 = a[0], m2 = a[0], m3 = a[0];
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        if (a[i] < m0) m0 = a[i];
+        if (a[i + 1] < m1) m1 = a[i + 1];
+        if (a[i + 2] < m2) m2 = a[i + 2];
+        if (a[i + 3] < m3) m3 = a[i + 3];
+    }
+    for (; i < n; i++) {
+        if (a[i] < m0) m0 = a[i];
+    }
+    if (m1 < m0) m0 = m1;
+    if (m3 < m2) m2 = m3;
+    return m2 < m0 ? m2 : m0;
+}
+
+int32_t mat_max(const int32_t *a, int32_t n) {
+    int32_t m0 = a[0], m1 = a[0], m2 = a[0], m3 = a[0];
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        if (a[i] > m0) m0 = a[i];
+        if (a[i + 1] > m1) m1 = a[i + 1];
+        if (a[i + 2] > m2) m2 = a[i + 2];
+        if (a[i + 3] > m3) m3 = a[i + 3];
+    }
+    for (; i < n; i++) {
+        if (a[i] > m0) m0 = a[i];
+    }
+    if (m1 > m0) m0 = m1;
+    if (m3 > m2) m2 = m3;
+    return m2 > m0 ? m2 : m0;
+}
+
+int32_t mat_dot(const int32_t *a, const int32_t *b, int32_t n) {
+    uint32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += (uint32_t)a[i] * (uint32_t)b[i];
+        s1 += (uint32_t)a[i + 1] * (uint32_t)b[i + 1];
+        s2 += (uint32_t)a[i + 2] * (uint32_t)b[i + 2];
+        s3 += (uint32_t)a[i + 3] * (uint32_t)b[i + 3];
+    }
+    for (; i < n; i++) {
+        s0 += (uint32_t)a[i] * (uint32_t)b[i];
+    }
+    return (int32_t)(s0 + s1 + s2 + s3);
+}
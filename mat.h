@@ -0,0 +1,20 @@
+#ifndef MAT_H
+#define MAT_H
+
+#include <stdint.h>
+
+// Whole-array kernels behind MAT, over n contiguous int32 elements.
+// Arithmetic wraps like the interpreter's other integer operations, and
+// dst may be one of the sources (MAT a=a*2)
+void mat_copy(int32_t *dst, const int32_t *a, int32_t n);
+void mat_add(int32_t *dst, const int32_t *a, const int32_t *b, int32_t n);
+void mat_sub(int32_t *dst, const int32_t *a, const int32_t *b, int32_t n);
+void mat_scale(int32_t *dst, const int32_t *a, int32_t k, int32_t n);
+
+// Reductions; n must be at least 1
+int32_t mat_sum(const int32_t *a, int32_t n);
+int32_t mat_min(const int32_t *a, int32_t n);
+int32_t mat_max(const int32_t *a, int32_t n);
+int32_t mat_dot(const int32_t *a, const int32_t *b, int32_t n);
+
+#endif
@@ -1,27 +1,303 @@
 #include "program.h"
+#include "data.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
 
-#define MAX_LINES 200
-#define MAX_LINE_LENGTH 256
+#define MAX_LINE_STATEMENTS (MAX_LINE_LENGTH / 2)  // "a:a:a..." at most
+#define ARENA_FIRST_SIZE 1024
+#define ARENA_MAX_SIZE 0xFFFF                      // Offsets are 16 bits
+#define ENTRY_HEADER 2                             // Slot number before each text
 
 typedef struct {
-    int line_num;
-    char text[MAX_LINE_LENGTH];
+    uint16_t offset;            // Text position in the arena
+    uint16_t length;            // Text length, not counting its '\0'
+    ParsedLine parsed;          // Tokens kept next to the text so RUN never re-tokenizes
 } ProgramLine;
 
-static ProgramLine program[MAX_LINES];
+typedef struct {
+    int line_num;               // Copied here so searches never touch the line bodies
+    int slot;                   // Where the line lives in lines[]
+} LineIndex;
+
+// Line texts are packed end to end in one arena, each followed by its '\0',
+// so a line costs its own length rather than a fixed MAX_LINE_LENGTH.
+// Each text is preceded by the slot of its line, so closing the gap a
+// deleted or replaced line leaves only touches the lines after it. The
+// arena starts empty and doubles as the program grows
+static char *arena = NULL;
+static int arena_used = 0;
+static int arena_capacity = 0;
+
+// Line bodies stay in their slot for as long as the line exists; only the
+// small index entries are moved to keep the program in line number order.
+// Both arrays grow as lines are added
+static ProgramLine *lines = NULL;
+static LineIndex *order = NULL;
 static int line_count = 0;
+static int line_capacity = 0;
+static int *free_slots = NULL;
+static int free_count = 0;
+static int bulk_loading = 0;    // Between prog_begin_load() and prog_end_load()
+
+// Statements and tokens of the line being parsed, before they're copied
+// to their own block
+static Statement scratch[MAX_LINE_STATEMENTS];
+static int scratch_count;
+static Token scratch_tokens[MAX_LINE_STATEMENTS * MAX_TOKENS];
+static int scratch_token_count;
+
+// Split text[start .. end) into statements, appending them to scratch.
+// Empty statements ("a=1::b=2") are dropped
+static void split_statements(const char *text, int start, int end) {
+    while (start < end && scratch_count < MAX_LINE_STATEMENTS) {
+        int stop = statement_end(text, start, end);
+        Statement *st = &scratch[scratch_count];
+        Token *tokens = &scratch_tokens[scratch_token_count];
+        int count = tokenize_range(text, start, stop, tokens, MAX_TOKENS);
+        start = stop + 1;
+        if (count == 0) {
+            continue;
+        }
+        scratch_count++;
+        scratch_token_count += count;
+        st->tokens = tokens;
+        st->token_count = count;
+        st->then_count = 0;
+        st->else_count = 0;
+        
+        // IF x>5 THEN stmts ELSE stmts: both parts follow the IF, tokenized
+        // now rather than on every branch. The IF ran to the end of the line
+        if (st->tokens[0].type == TOKEN_IF) {
+            int first = scratch_count;
+            if (count >= 4) {
+                split_statements(text, st->tokens[3].start, st->tokens[3].start + st->tokens[3].length);
+            }
+            st->then_count = scratch_count - first;
+            first = scratch_count;
+            if (count >= 6) {
+                split_statements(text, st->tokens[5].start, st->tokens[5].start + st->tokens[5].length);
+            }
+            st->else_count = scratch_count - first;
+        }
+    }
+}
+
+static void parse_line(ParsedLine *parsed, const char *text) {
+    free(parsed->stmts);
+    parsed->text = text;
+    parsed->stmts = NULL;
+    parsed->stmt_count = 0;
+    
+    scratch_count = 0;
+    scratch_token_count = 0;
+    split_statements(text, 0, strlen(text));
+    if (scratch_count == 0) {
+        return;
+    }
+    
+    // One block: the statements, then all their tokens in the same order
+    parsed->stmts = malloc(sizeof(Statement) * scratch_count + sizeof(Token) * scratch_token_count);
+    if (!parsed->stmts) {
+        printf("?OUT OF MEMORY\n");
+        return;
+    }
+    Token *tokens = (Token *)(parsed->stmts + scratch_count);
+    memcpy(tokens, scratch_tokens, sizeof(Token) * scratch_token_count);
+    for (int i = 0; i < scratch_count; i++) {
+        parsed->stmts[i] = scratch[i];
+        parsed->stmts[i].tokens = tokens + (scratch[i].tokens - scratch_tokens);
+    }
+    parsed->stmt_count = scratch_count;
+}
+
+// Point the lines whose entries start in arena[from .. arena_used) at
+// where their texts are now
+static void relocate_texts(int from) {
+    while (from < arena_used) {
+        int slot = (uint8_t)arena[from] | (uint8_t)arena[from + 1] << 8;
+        ProgramLine *line = &lines[slot];
+        line->offset = from + ENTRY_HEADER;
+        line->parsed.text = &arena[line->offset];
+        from = line->offset + line->length + 1;
+    }
+}
+
+// Make sure the arena can take size more bytes. Returns -1 if it can't
+static int reserve_arena(int size) {
+    if (arena_used + size <= arena_capacity) {
+        return 0;
+    }
+    if (arena_used + size > ARENA_MAX_SIZE) {
+        return -1;
+    }
+    int capacity = arena_capacity ? arena_capacity * 2 : ARENA_FIRST_SIZE;
+    while (capacity < arena_used + size) {
+        capacity *= 2;
+    }
+    if (capacity > ARENA_MAX_SIZE) {
+        capacity = ARENA_MAX_SIZE;
+    }
+    char *grown = realloc(arena, capacity);
+    if (!grown) {
+        return -1;
+    }
+    arena = grown;
+    arena_capacity = capacity;
+    relocate_texts(0);
+    return 0;
+}
+
+// Remove a line's text from the arena, moving the texts after it down
+static void release_text(int slot) {
+    ProgramLine *line = &lines[slot];
+    if (!line->parsed.text) {
+        return;
+    }
+    int start = line->offset - ENTRY_HEADER;
+    int size = ENTRY_HEADER + line->length + 1;
+    memmove(&arena[start], &arena[start + size], arena_used - start - size);
+    arena_used -= size;
+    line->parsed.text = NULL;
+    relocate_texts(start);
+}
+
+// Copy a command into a line and tokenize it. Trailing spaces are dropped
+// so that a statement's last argument ends exactly at the end of the text.
+// Returns -1, leaving the line as it was, if the arena is full
+static int set_line(int slot, const char *cmd) {
+    ProgramLine *line = &lines[slot];
+    int len = strlen(cmd);
+    while (len > 0 && (cmd[len - 1] == ' ' || cmd[len - 1] == '\t')) {
+        len--;
+    }
+    // Room is made first, so a failed edit leaves the line as it was; a
+    // replaced line's own text still counts, as it's released afterwards
+    if (reserve_arena(ENTRY_HEADER + len + 1) != 0) {
+        printf("?OUT OF MEMORY\n");
+        return -1;
+    }
+    release_text(slot);
+    arena[arena_used] = slot & 0xFF;
+    arena[arena_used + 1] = slot >> 8;
+    line->offset = arena_used + ENTRY_HEADER;
+    line->length = len;
+    memcpy(&arena[line->offset], cmd, len);
+    arena[line->offset + len] = '\0';
+    arena_used = line->offset + len + 1;
+    parse_line(&line->parsed, &arena[line->offset]);
+    return 0;
+}
+
+// Double the number of line slots. Returns -1 if there's no memory
+static int grow_lines(void) {
+    int capacity = line_capacity ? line_capacity * 2 : 32;
+    ProgramLine *new_lines = realloc(lines, sizeof(ProgramLine) * capacity);
+    if (!new_lines) {
+        return -1;
+    }
+    lines = new_lines;
+    LineIndex *new_order = realloc(order, sizeof(LineIndex) * capacity);
+    if (!new_order) {
+        return -1;
+    }
+    order = new_order;
+    int *new_free = realloc(free_slots, sizeof(int) * capacity);
+    if (!new_free) {
+        return -1;
+    }
+    free_slots = new_free;
+    
+    // Hand out low slots first
+    for (int i = capacity - 1; i >= line_capacity; i--) {
+        lines[i].parsed.text = NULL;
+        lines[i].parsed.stmts = NULL;
+        lines[i].parsed.stmt_count = 0;
+        free_slots[free_count++] = i;
+    }
+    line_capacity = capacity;
+    return 0;
+}
+
+// Store a command in a free slot. Returns the slot, or -1 if out of memory
+static int alloc_line(const char *cmd) {
+    if (free_count == 0 && grow_lines() != 0) {
+        printf("?OUT OF MEMORY\n");
+        return -1;
+    }
+    int slot = free_slots[free_count - 1];
+    if (set_line(slot, cmd) != 0) {
+        return -1;
+    }
+    free_count--;
+    return slot;
+}
+
+static void free_line(int slot) {
+    release_text(slot);
+    free(lines[slot].parsed.stmts);
+    lines[slot].parsed.stmts = NULL;
+    lines[slot].parsed.stmt_count = 0;
+    free_slots[free_count++] = slot;
+}
+
+// Check if a line holds a DATA statement, whose values the pool keeps
+static int has_data(const ParsedLine *parsed) {
+    for (int i = 0; i < parsed->stmt_count; i++) {
+        if (parsed->stmts[i].tokens[0].type == TOKEN_DATA) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Binary search for line_num. Returns its position in order[], or if it
+// isn't stored, -(position it would be inserted at) - 1
+static int find_index(int line_num) {
+    int lo = 0;
+    int hi = line_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (order[mid].line_num < line_num) {
+            lo = mid + 1;
+        } else if (order[mid].line_num > line_num) {
+            hi = mid - 1;
+        } else {
+            return mid;
+        }
+    }
+    return -lo - 1;
+}
 
 void prog_init(void) {
     line_count = 0;
-    memset(program, 0, sizeof(program));
+    bulk_loading = 0;
+    arena_used = 0;
+    
+    // Hand out low slots first
+    free_count = line_capacity;
+    for (int i = 0; i < line_capacity; i++) {
+        free_slots[i] = line_capacity - 1 - i;
+    }
 }
 
 void prog_clear(void) {
+    // The whole arena is dropped at once, so there's nothing to compact
+    for (int i = 0; i < line_count; i++) {
+        ParsedLine *parsed = &lines[order[i].slot].parsed;
+        free(parsed->stmts);
+        parsed->text = NULL;
+        parsed->stmts = NULL;
+        parsed->stmt_count = 0;
+    }
     prog_init();
+    
+    // Give the arena back for variables and arrays; it grows again on demand
+    free(arena);
+    arena = NULL;
+    arena_capacity = 0;
+    data_invalidate();
 }
 
 int prog_has_line_number(const char *line, int *line_num) {
@@ -57,82 +333,181 @@ void prog_store_line(const char *line) {
         cmd++;
     }
     
-    // Find if this line number already exists
-    int idx = -1;
-    for (int i = 0; i < line_count; i++) {
-        if (program[i].line_num == line_num) {
-            idx = i;
-            break;
+    if (bulk_loading) {
+        // Append as-is; prog_end_load() sorts and settles duplicates once.
+        // An empty command is kept too, as a deletion
+        int slot = alloc_line(cmd);
+        if (slot >= 0) {
+            order[line_count].line_num = line_num;
+            order[line_count].slot = slot;
+            line_count++;
         }
+        return;
     }
     
+    // The DATA pool only goes out of date when a line holding DATA comes or goes
+    int idx = find_index(line_num);
+    
     // If command is empty, delete the line
     if (*cmd == '\0') {
         if (idx >= 0) {
-            // Delete by shifting lines down
-            for (int i = idx; i < line_count - 1; i++) {
-                program[i] = program[i + 1];
-            }
+            int had_data = has_data(&lines[order[idx].slot].parsed);
+            free_line(order[idx].slot);
+            memmove(&order[idx], &order[idx + 1], sizeof(LineIndex) * (line_count - idx - 1));
             line_count--;
+            if (had_data) {
+                data_invalidate();
+            }
         }
         return;
     }
     
-    // If line exists, replace it
+    // If line exists, replace it in its slot
     if (idx >= 0) {
-        strcpy(program[idx].text, cmd);
+        ParsedLine *parsed = &lines[order[idx].slot].parsed;
+        int had_data = has_data(parsed);
+        if (set_line(order[idx].slot, cmd) == 0 && (had_data || has_data(parsed))) {
+            data_invalidate();
+        }
         return;
     }
     
-    // Add new line if there's space
-    if (line_count < MAX_LINES) {
-        program[line_count].line_num = line_num;
-        strcpy(program[line_count].text, cmd);
+    // Add new line if there's space, opening a gap in the index
+    int slot = alloc_line(cmd);
+    if (slot >= 0) {
+        idx = -idx - 1;
+        memmove(&order[idx + 1], &order[idx], sizeof(LineIndex) * (line_count - idx));
+        order[idx].line_num = line_num;
+        order[idx].slot = slot;
         line_count++;
-        
-        // Sort by line number (simple bubble sort)
-        for (int i = 0; i < line_count - 1; i++) {
-            for (int j = 0; j < line_count - i - 1; j++) {
-                if (program[j].line_num > program[j + 1].line_num) {
-                    ProgramLine temp = program[j];
-                    program[j] = program[j + 1];
-                    program[j + 1] = temp;
-                }
+        if (has_data(&lines[slot].parsed)) {
+            data_invalidate();
+        }
+    }
+}
+
+void prog_begin_load(void) {
+    bulk_loading = 1;
+}
+
+// Stable merge sort of order[] by line number, so that of two copies of a
+// line number the one stored later still comes later
+static void sort_index(void) {
+    LineIndex *scratch = malloc(sizeof(LineIndex) * line_count);
+    if (!scratch) {
+        // No memory for the merge: stable insertion sort instead
+        for (int i = 1; i < line_count; i++) {
+            LineIndex entry = order[i];
+            int j = i;
+            while (j > 0 && order[j - 1].line_num > entry.line_num) {
+                order[j] = order[j - 1];
+                j--;
             }
+            order[j] = entry;
         }
+        return;
     }
+    
+    for (int width = 1; width < line_count; width *= 2) {
+        for (int lo = 0; lo < line_count; lo += 2 * width) {
+            int mid = lo + width < line_count ? lo + width : line_count;
+            int hi = lo + 2 * width < line_count ? lo + 2 * width : line_count;
+            int a = lo, b = mid, out = lo;
+            while (a < mid && b < hi) {
+                scratch[out++] = order[b].line_num < order[a].line_num ? order[b++] : order[a++];
+            }
+            while (a < mid) scratch[out++] = order[a++];
+            while (b < hi) scratch[out++] = order[b++];
+        }
+        memcpy(order, scratch, sizeof(LineIndex) * line_count);
+    }
+    free(scratch);
 }
 
-const char* prog_get_line(int line_num) {
+void prog_end_load(void) {
+    if (!bulk_loading) {
+        return;
+    }
+    bulk_loading = 0;
+    
+    // Saved programs are already in order, so usually there's nothing to sort
+    for (int i = 1; i < line_count; i++) {
+        if (order[i - 1].line_num >= order[i].line_num) {
+            sort_index();
+            break;
+        }
+    }
+    
+    // Keep the last copy of each line number, and drop it if it's a deletion
+    int kept = 0;
     for (int i = 0; i < line_count; i++) {
-        if (program[i].line_num == line_num) {
-            return program[i].text;
+        int replaced = i + 1 < line_count && order[i + 1].line_num == order[i].line_num;
+        if (!replaced && lines[order[i].slot].length > 0) {
+            order[kept++] = order[i];
+        } else {
+            free_line(order[i].slot);
         }
     }
-    return NULL;
+    line_count = kept;
+    data_invalidate();
+}
+
+const char* prog_get_line(int line_num) {
+    int idx = find_index(line_num);
+    return idx >= 0 ? lines[order[idx].slot].parsed.text : NULL;
+}
+
+const ParsedLine* prog_get_parsed(int line_num) {
+    int idx = find_index(line_num);
+    return idx >= 0 ? &lines[order[idx].slot].parsed : NULL;
 }
 
 int prog_first_line(void) {
     if (line_count > 0) {
-        return program[0].line_num;
+        return order[0].line_num;
     }
     return -1;
 }
 
 int prog_next_line(int current_line) {
-    for (int i = 0; i < line_count; i++) {
-        if (program[i].line_num == current_line) {
-            if (i + 1 < line_count) {
-                return program[i + 1].line_num;
-            }
-            break;
-        }
+    int idx = find_index(current_line);
+    if (idx >= 0 && idx + 1 < line_count) {
+        return order[idx + 1].line_num;
+    }
+    return -1;
+}
+
+int prog_line_count(void) {
+    return line_count;
+}
+
+int prog_text_bytes(void) {
+    return arena_used;
+}
+
+int prog_line_at(int index) {
+    if (index >= 0 && index < line_count) {
+        return order[index].line_num;
     }
     return -1;
 }
 
+const char* prog_text_at(int index) {
+    if (index >= 0 && index < line_count) {
+        return lines[order[index].slot].parsed.text;
+    }
+    return NULL;
+}
+
+const ParsedLine* prog_parsed_at(int index) {
+    if (index >= 0 && index < line_count) {
+        return &lines[order[index].slot].parsed;
+    }
+    return NULL;
+}
+
 void prog_list(void) {
     for (int i = 0; i < line_count; i++) {
-        printf("%d %s\n", program[i].line_num, program[i].text);
+        printf("%d %s\n", order[i].line_num, lines[order[i].slot].parsed.text);
     }
 }
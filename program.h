@@ -1,21 +1,64 @@
 #ifndef PROGRAM_H
 #define PROGRAM_H
 
+#include "token.h"
+
+#define MAX_LINE_LENGTH 256
+
+// One statement of a line; its tokens are slices of the line text, kept
+// in the line's own block with exactly as many tokens as it has
+typedef struct {
+    const Token *tokens;
+    uint8_t token_count;
+    uint8_t then_count;              // IF only: the next then_count statements are the THEN part,
+    uint8_t else_count;              // and the else_count after those the ELSE part
+} Statement;
+
+// Pre-tokenized form of a stored line, built once when the line is entered.
+// "a=1: b=2: IF a THEN c=3: d=4 ELSE e=5" is split at each ':' into a flat
+// statement list; an IF always ends the line, so its THEN and ELSE parts are
+// the statements that follow it.
+typedef struct {
+    const char *text;                // Line text (without the line number)
+    Statement *stmts;                // Sized to fit, tokens after them; NULL for a line without statements
+    int stmt_count;
+} ParsedLine;
+
 // Initialize program storage
 void prog_init(void);
 
 // Store a numbered line (e.g., "10 PRINT hello")
 void prog_store_line(const char *line);
 
+// Bulk load (LOAD): lines stored between these calls are appended without
+// ordering and sorted once at the end. A later copy of a line number
+// replaces an earlier one, and a bare line number deletes it.
+void prog_begin_load(void);
+void prog_end_load(void);
+
 // Get a line by line number
 const char* prog_get_line(int line_num);
 
+// Get the pre-tokenized form of a line (NULL if the line doesn't exist)
+const ParsedLine* prog_get_parsed(int line_num);
+
 // Get the next line number after the given one (for sequential execution)
 int prog_next_line(int current_line);
 
 // Get the first line number
 int prog_first_line(void);
 
+// Number of stored lines
+int prog_line_count(void);
+
+// Bytes of program text held, terminators included
+int prog_text_bytes(void);
+
+// Line number, text and pre-tokenized form by position (0 .. prog_line_count()-1, in line order)
+int prog_line_at(int index);
+const char* prog_text_at(int index);
+const ParsedLine* prog_parsed_at(int index);
+
 // Clear all stored lines
 void prog_clear(void);
 
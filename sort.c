@@ -0,0 +1,165 @@
+#include "sort.h"
+#include "strheap.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Sorting works on a permutation of positions rather than on the elements,
+// so numbers and strings share one merge sort, the sort is stable, and the
+// permutation is the companion index SORT can hand back. Short runs are
+// insertion sorted first, then merged bottom-up between two buffers
+#define RUN 16
+
+typedef struct {
+    const int32_t *nums;        // Numeric keys, or NULL for string keys
+    const char *const *strs;
+    int descending;
+} Keys;
+
+// Order two slices byte by byte; a prefix comes first
+static int compare_text(const char *a, int32_t alen, const char *b, int32_t blen) {
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    return c ? c : (alen > blen) - (alen < blen);
+}
+
+static int compare_string(const char *a, const char *s, int32_t len) {
+    return a ? compare_text(a, strheap_length(a), s, len) : -(len > 0);
+}
+
+static int compare_keys(const Keys *k, int32_t i, int32_t j) {
+    int c;
+    if (k->nums) {
+        c = (k->nums[i] > k->nums[j]) - (k->nums[i] < k->nums[j]);
+    } else {
+        const char *b = k->strs[j];
+        c = compare_string(k->strs[i], b ? b : "", b ? strheap_length(b) : 0);
+    }
+    return k->descending ? -c : c;
+}
+
+// Merge the sorted runs src[lo .. mid) and src[mid .. hi) into dst
+static void merge(const Keys *k, const int32_t *src, int32_t *dst, int32_t lo, int32_t mid, int32_t hi) {
+    int32_t i = lo, j = mid, out = lo;
+    while (i < mid && j < hi) {
+        // Ties take from the left run, which keeps the sort stable
+        dst[out++] = (compare_keys(k, src[j], src[i]) < 0) ? src[j++] : src[i++];
+    }
+    while (i < mid) dst[out++] = src[i++];
+    while (j < hi) dst[out++] = src[j++];
+}
+
+// Sort the positions 0 .. n-1 by key, using perm and spare (n each).
+// Returns whichever of the two ends up holding the result
+static int32_t* sort_order(const Keys *k, int32_t n, int32_t *perm, int32_t *spare) {
+    for (int32_t i = 0; i < n; i++) {
+        perm[i] = i;
+    }
+    for (int32_t start = 0; start < n; start += RUN) {
+        int32_t end = (start + RUN < n) ? start + RUN : n;
+        for (int32_t i = start + 1; i < end; i++) {
+            int32_t x = perm[i];
+            int32_t j = i;
+            while (j > start && compare_keys(k, x, perm[j - 1]) < 0) {
+                perm[j] = perm[j - 1];
+                j--;
+            }
+            perm[j] = x;
+        }
+    }
+    
+    int32_t *src = perm, *dst = spare;
+    for (int32_t width = RUN; width < n; width *= 2) {
+        for (int32_t lo = 0; lo < n; lo += 2 * width) {
+            int32_t mid = (lo + width < n) ? lo + width : n;
+            int32_t hi = (lo + 2 * width < n) ? lo + 2 * width : n;
+            merge(k, src, dst, lo, mid, hi);
+        }
+        int32_t *t = src;
+        src = dst;
+        dst = t;
+    }
+    return src;
+}
+
+int sort_numbers(int32_t *a, int32_t n, int descending, int32_t *order) {
+    int32_t *perm = malloc(sizeof(int32_t) * (n + 1));
+    int32_t *spare = malloc(sizeof(int32_t) * (n + 1));
+    if (!perm || !spare) {
+        free(perm);
+        free(spare);
+        return -1;
+    }
+    Keys keys = {a, NULL, descending};
+    int32_t *sorted = sort_order(&keys, n, perm, spare);
+    
+    // The other buffer is free again; gather the elements through it
+    int32_t *copy = (sorted == perm) ? spare : perm;
+    memcpy(copy, a, sizeof(int32_t) * n);
+    for (int32_t i = 0; i < n; i++) {
+        a[i] = copy[sorted[i]];
+    }
+    if (order) {
+        memcpy(order, sorted, sizeof(int32_t) * n);
+    }
+    free(perm);
+    free(spare);
+    return 0;
+}
+
+int sort_strings(const char **a, int32_t n, int descending, int32_t *order) {
+    int32_t *perm = malloc(sizeof(int32_t) * (n + 1));
+    int32_t *spare = malloc(sizeof(int32_t) * (n + 1));
+    const char **copy = malloc(sizeof(const char *) * (n + 1));
+    if (!perm || !spare || !copy) {
+        free(perm);
+        free(spare);
+        free(copy);
+        return -1;
+    }
+    Keys keys = {NULL, a, descending};
+    int32_t *sorted = sort_order(&keys, n, perm, spare);
+    
+    // Only the pointers move; every string keeps its one reference
+    memcpy(copy, a, sizeof(const char *) * n);
+    for (int32_t i = 0; i < n; i++) {
+        a[i] = copy[sorted[i]];
+    }
+    if (order) {
+        memcpy(order, sorted, sizeof(int32_t) * n);
+    }
+    free(perm);
+    free(spare);
+    free(copy);
+    return 0;
+}
+
+int32_t search_numbers(const int32_t *a, int32_t n, int32_t value) {
+    if (n == 0) return -1;
+    int descending = a[0] > a[n - 1];
+    int32_t lo = 0, hi = n;
+    while (lo < hi) {
+        int32_t mid = lo + (hi - lo) / 2;
+        if (descending ? a[mid] > value : a[mid] < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo < n && a[lo] == value) ? lo : -1;
+}
+
+int32_t search_strings(const char *const *a, int32_t n, const char *s, int32_t len) {
+    if (n == 0) return -1;
+    const char *last = a[n - 1];
+    int descending = compare_string(a[0], last ? last : "", last ? strheap_length(last) : 0) > 0;
+    int32_t lo = 0, hi = n;
+    while (lo < hi) {
+        int32_t mid = lo + (hi - lo) / 2;
+        int c = compare_string(a[mid], s, len);
+        if (descending ? c > 0 : c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo < n && compare_string(a[lo], s, len) == 0) ? lo : -1;
+}
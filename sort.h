@@ -0,0 +1,17 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stdint.h>
+
+// Stable sort of n numbers or string-heap strings (NULL is ""), ascending
+// or descending. If order isn't NULL, order[k] receives the position the
+// element now at k came from. Returns -1 if there's no memory to sort in
+int sort_numbers(int32_t *a, int32_t n, int descending, int32_t *order);
+int sort_strings(const char **a, int32_t n, int descending, int32_t *order);
+
+// Binary search of sorted data for a value; the direction is taken from the
+// ends of the data. Returns the first position holding it, or -1
+int32_t search_numbers(const int32_t *a, int32_t n, int32_t value);
+int32_t search_strings(const char *const *a, int32_t n, const char *s, int32_t len);
+
+#endif
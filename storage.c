@@ -40,20 +40,16 @@ int storage_save(void) {
     static char program_data[32768];  // 32KB buffer (static to keep off stack)
     int offset = 0;
     
-    int line_num = prog_first_line();
-    while (line_num >= 0) {
-        const char *line_text = prog_get_line(line_num);
-        if (line_text) {
-            int written = snprintf(program_data + offset, 
-                                  sizeof(program_data) - offset,
-                                  "%d %s\n", line_num, line_text);
-            if (written < 0 || offset + written >= sizeof(program_data)) {
-                printf("?PROGRAM TOO LARGE\n");
-                return -1;
-            }
-            offset += written;
+    // Straight out of the program arena, in line order
+    for (int i = 0; i < prog_line_count(); i++) {
+        int written = snprintf(program_data + offset, 
+                              sizeof(program_data) - offset,
+                              "%d %s\n", prog_line_at(i), prog_text_at(i));
+        if (written < 0 || offset + written >= sizeof(program_data)) {
+            printf("?PROGRAM TOO LARGE\n");
+            return -1;
         }
-        line_num = prog_next_line(line_num);
+        offset += written;
     }
     program_data[offset] = '\0';
     
@@ -133,8 +129,9 @@ int storage_load(void) {
         return -1;
     }
     
-    // Clear current program
+    // Clear current program and take the lines in one batch
     prog_clear();
+    prog_begin_load();
     
     // Parse and load lines
     char line_buffer[256];
@@ -157,6 +154,7 @@ int storage_load(void) {
         line_buffer[buf_pos] = '\0';
         prog_store_line(line_buffer);
     }
+    prog_end_load();
     
     printf("Program loaded (%d bytes)\n", header->program_size);
     return 0;
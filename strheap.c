@@ -0,0 +1,183 @@
+#include "strheap.h"
+#include <stdio.h>
+#include <string.h>
+
+#if STRING_HEAP_SIZE > 65534
+#error "STRING_HEAP_SIZE must be under 64 KB"
+#endif
+
+// Blocks tile the heap from start to end: a header, then the text and its
+// '\0', rounded up to an even size. A block without references is free;
+// free neighbours are merged when a search passes them. When no free block
+// is big enough but the free space in total is, the live blocks are slid
+// down into one piece and their holders are told where they went
+typedef struct {
+    uint16_t size;      // Whole block, header included
+    uint16_t refs;      // 0 for a free block
+    uint16_t length;    // Text length
+    uint16_t forward;   // While compacting: where the block is moving to
+} Block;
+
+#define MAX_REFS 0xFFFF
+#define MIN_SPLIT (sizeof(Block) + 2)   // Smallest remainder worth a block of its own
+
+static uint16_t heap_space[STRING_HEAP_SIZE / 2];
+#define heap ((char *)heap_space)
+#define HEAP_END ((int)sizeof(heap_space))
+
+static int rover = 0;       // Next fit: searches start after the last allocation
+static int used = 0;        // Bytes in live blocks
+static void (*roots)(void); // Passes every stored string to strheap_relocate
+
+static Block* block_at(int pos) {
+    return (Block *)(heap + pos);
+}
+
+static Block* header(const char *s) {
+    return (Block *)(s - sizeof(Block));
+}
+
+void strheap_init(void) {
+    block_at(0)->size = HEAP_END;
+    block_at(0)->refs = 0;
+    rover = 0;
+    used = 0;
+}
+
+// First free block of at least need bytes in [from, to). Returns -1 if none
+static int find_free(int from, int to, int need) {
+    int pos = from;
+    while (pos < to) {
+        Block *b = block_at(pos);
+        if (b->refs == 0) {
+            while (pos + b->size < HEAP_END && block_at(pos + b->size)->refs == 0) {
+                int next = pos + b->size;
+                b->size += block_at(next)->size;
+                if (rover == next) {
+                    rover = pos;
+                }
+            }
+            if (b->size >= need) {
+                return pos;
+            }
+        }
+        pos += b->size;
+    }
+    return -1;
+}
+
+void strheap_set_roots(void (*relocate_all)(void)) {
+    roots = relocate_all;
+}
+
+void strheap_relocate(const char **s) {
+    if (*s && strheap_contains(*s)) {
+        *s = heap + header(*s)->forward + sizeof(Block);
+    }
+}
+
+// Slide the live blocks to the start of the heap, leaving one free block
+// after them, and return its position. *pinned, which may point anywhere
+// into a live string, is moved along with it
+static int compact(const char **pinned) {
+    int pin = strheap_contains(*pinned) ? *pinned - heap : -1;
+    
+    // Work out where every live block goes
+    int to = 0;
+    for (int pos = 0; pos < HEAP_END; pos += block_at(pos)->size) {
+        Block *b = block_at(pos);
+        if (b->refs) {
+            if (pin >= pos && pin < pos + b->size) {
+                *pinned = heap + to + (pin - pos);
+            }
+            b->forward = to;
+            to += b->size;
+        }
+    }
+    
+    // Redirect the holders while the old headers are still in place, then
+    // move. A block only ever moves down, over space already walked past
+    if (roots) {
+        roots();
+    }
+    for (int pos = 0; pos < HEAP_END; ) {
+        Block *b = block_at(pos);
+        int size = b->size;
+        if (b->refs) {
+            memmove(heap + b->forward, b, size);
+        }
+        pos += size;
+    }
+    
+    block_at(to)->size = HEAP_END - to;
+    block_at(to)->refs = 0;
+    rover = to;
+    return to;
+}
+
+const char* strheap_alloc(const char *text, int length) {
+    int need = (sizeof(Block) + length + 1 + 1) & ~1;
+    int pos = -1;
+    if (need <= HEAP_END) {
+        pos = find_free(rover, HEAP_END, need);
+        if (pos < 0) {
+            pos = find_free(0, HEAP_END, need);
+        }
+        if (pos < 0 && HEAP_END - used >= need) {
+            // Enough room in total, just not in one piece
+            pos = compact(&text);
+        }
+    }
+    if (pos < 0) {
+        printf("?OUT OF STRING SPACE\n");
+        return NULL;
+    }
+    
+    Block *b = block_at(pos);
+    if (b->size - need >= (int)MIN_SPLIT) {
+        Block *rest = block_at(pos + need);
+        rest->size = b->size - need;
+        rest->refs = 0;
+        b->size = need;
+    }
+    b->refs = 1;
+    b->length = length;
+    used += b->size;
+    rover = (pos + b->size < HEAP_END) ? pos + b->size : 0;
+    
+    char *s = (char *)(b + 1);
+    memcpy(s, text, length);
+    s[length] = '\0';
+    return s;
+}
+
+const char* strheap_share(const char *s) {
+    Block *b = header(s);
+    if (b->refs == MAX_REFS) {
+        return strheap_alloc(s, b->length);
+    }
+    b->refs++;
+    return s;
+}
+
+void strheap_release(const char *s) {
+    if (!s) {
+        return;
+    }
+    Block *b = header(s);
+    if (--b->refs == 0) {
+        used -= b->size;
+    }
+}
+
+int strheap_contains(const char *s) {
+    return s >= heap && s < heap + HEAP_END;
+}
+
+int strheap_length(const char *s) {
+    return header(s)->length;
+}
+
+int strheap_free(void) {
+    return HEAP_END - used;
+}
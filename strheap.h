@@ -0,0 +1,41 @@
+#ifndef STRHEAP_H
+#define STRHEAP_H
+
+#include <stdint.h>
+
+// Bytes set aside for string values. Block sizes are 16 bits, so it must
+// stay under 64 KB
+#ifndef STRING_HEAP_SIZE
+#define STRING_HEAP_SIZE (16 * 1024)
+#endif
+
+// Drop every string at once (NEW, RUN, CLEAR)
+void strheap_init(void);
+
+// Copy text[0 .. length) into a new, exactly sized string holding one
+// reference. Returns NULL if the heap is full (message printed)
+const char* strheap_alloc(const char *text, int length);
+
+// Take another reference to a heap string instead of copying it.
+// Returns s, or a fresh copy in the rare case its count is saturated
+const char* strheap_share(const char *s);
+
+// Drop a reference; the string is freed with its last one. NULL is ignored
+void strheap_release(const char *s);
+
+// Heap strings can move when the heap is compacted. The holders register
+// one function that passes the address of every string pointer they keep
+// to strheap_relocate, which updates it
+void strheap_set_roots(void (*relocate_all)(void));
+void strheap_relocate(const char **s);
+
+// Check if s points into the string heap
+int strheap_contains(const char *s);
+
+// Length of a heap string, without scanning it
+int strheap_length(const char *s);
+
+// Bytes not taken by live strings
+int strheap_free(void);
+
+#endif
@@ -1,692 +1,473 @@
 #include "token.h"
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdio.h>
+#include <stdint.h>
 
-// Convert a string to uppercase
-static void to_upper(char *str) {
-    while (*str) {
-        *str = toupper(*str);
-        str++;
-    }
+#define MAX_KEYWORD_LEN 8
+#define KEYWORD_TABLE_SIZE 128  // Power of two, about 4x the keyword count
+
+typedef struct {
+    const char *name;
+    TokenType type;
+} Keyword;
+
+// Statement keywords recognized at the start of a line
+static const Keyword keywords[] = {
+    {"PRINT", TOKEN_PRINT},   {"LET", TOKEN_LET},       {"IF", TOKEN_IF},
+    {"INPUT", TOKEN_INPUT},   {"REM", TOKEN_REM},       {"LIST", TOKEN_LIST},
+    {"RUN", TOKEN_RUN},       {"NEW", TOKEN_NEW},       {"FOR", TOKEN_FOR},
+    {"NEXT", TOKEN_NEXT},     {"WHILE", TOKEN_WHILE},   {"WEND", TOKEN_WEND},
+    {"END", TOKEN_END},       {"NOTE", TOKEN_NOTE},     {"SAVE", TOKEN_SAVE},
+    {"LOAD", TOKEN_LOAD},     {"DIR", TOKEN_DIR},       {"RM", TOKEN_RM},
+    {"FORMAT", TOKEN_FORMAT}, {"CD", TOKEN_CD},         {"PWD", TOKEN_PWD},
+    {"MKDIR", TOKEN_MKDIR},   {"RMDIR", TOKEN_RMDIR},   {"DRIVES", TOKEN_DRIVES},
+    {"CLS", TOKEN_CLS},       {"BENCH", TOKEN_BENCH},   {"GOSUB", TOKEN_GOSUB},
+    {"GOTO", TOKEN_GOTO},     {"RETURN", TOKEN_RETURN}, {"ON", TOKEN_ON},
+    {"SELECT", TOKEN_SELECT}, {"CASE", TOKEN_CASE},     {"DEF", TOKEN_DEF},
+    {"DIM", TOKEN_DIM},       {"MEM", TOKEN_MEM},       {"MAT", TOKEN_MAT},
+    {"SORT", TOKEN_SORT},     {"SEARCH", TOKEN_SEARCH},
+    {"DATA", TOKEN_DATA},     {"READ", TOKEN_READ},     {"RESTORE", TOKEN_RESTORE},
+};
+
+#define KEYWORD_COUNT ((int)(sizeof(keywords) / sizeof(keywords[0])))
+
+// Perfect hash: slot -> keyword index + 1 (0 = empty). The seed is picked
+// once so that no two keywords share a slot; a lookup is then one hash
+// over the word plus one compare.
+static uint8_t keyword_table[KEYWORD_TABLE_SIZE];
+static uint32_t keyword_seed = 0;
+
+static inline uint32_t hash_step(uint32_t hash, char c) {
+    // Letters only, so clearing bit 5 uppercases
+    return (hash ^ (uint8_t)(c & ~0x20)) * 16777619u;
 }
 
-Token* tokenize(const char *line, int *token_count) {
-    Token* tokens = malloc(sizeof(Token) * 10);
-    *token_count = 0;
-    
-    // Initialize tokens
-    memset(tokens, 0, sizeof(Token) * 10);
-    
-    // Skip leading whitespace
-    while (*line == ' ' || *line == '\t') {
-        line++;
+static inline uint32_t hash_slot(uint32_t hash) {
+    return (hash ^ (hash >> 16)) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+static uint32_t hash_word(const char *word, uint32_t seed) {
+    uint32_t hash = seed;
+    while (*word) {
+        hash = hash_step(hash, *word++);
     }
-    
-    // Make a working copy so we can convert to uppercase
-    char command[256];
-    strcpy(command, line);
-    to_upper(command);
-    
-    // Check for PRINT
-    if (strncmp(command, "PRINT", 5) == 0) {
-        tokens[0].type = TOKEN_PRINT;
-        strcpy(tokens[0].value, "PRINT");
-        *token_count = 1;
-        
-        // Get the argument (what to print)
-        line += 5;  // Skip "PRINT"
-        while (*line == ' ' || *line == '\t') {
-            line++;  // Skip spaces
+    return hash;
+}
+
+static void build_keyword_table(void) {
+    for (uint32_t seed = 2166136261u; ; seed++) {
+        memset(keyword_table, 0, sizeof(keyword_table));
+        int i;
+        for (i = 0; i < KEYWORD_COUNT; i++) {
+            uint32_t slot = hash_slot(hash_word(keywords[i].name, seed));
+            if (keyword_table[slot]) break;  // Collision, try the next seed
+            keyword_table[slot] = i + 1;
         }
-        
-        // Parse print items - separated by spaces or semicolons
-        while (*line != '\0' && *token_count < 10) {
-            // Handle quoted strings: "hello"
-            if (*line == '"') {
-                line++;  // Skip opening quote
-                char *dest = tokens[*token_count].value;
-                int found_closing = 0;
-                while (*line) {
-                    if (*line == '"') {
-                        found_closing = 1;
-                        line++;  // Skip closing quote
-                        break;
-                    }
-                    *dest++ = *line++;
-                }
-                *dest = '\0';  // Null terminate
-                
-                // Check if we found the closing quote
-                if (!found_closing) {
-                    tokens[0].type = TOKEN_UNKNOWN;
-                    strcpy(tokens[0].value, "SYNTAX ERROR: missing closing quote");
-                    *token_count = 1;
-                    return tokens;
-                }
-                
-                tokens[*token_count].type = TOKEN_PRINT;
-                tokens[*token_count].is_string_literal = 1;  // Mark as string literal
-                tokens[*token_count].has_semicolon = 0;  // Reset semicolon flag
-                (*token_count)++;
-                
-                // Check for semicolon after quoted string
-                while (*line == ' ' || *line == '\t') {
-                    line++;
-                }
-                if (*line == ';') {
-                    tokens[*token_count - 1].has_semicolon = 1;  // Mark previous token as having semicolon
-                    line++;
-                    while (*line == ' ' || *line == '\t') {
-                        line++;
-                    }
-                }
-            } else if (*line == ';') {
-                // Skip semicolon and spaces
-                line++;
-                while (*line == ' ' || *line == '\t') {
-                    line++;
-                }
-                continue;
-            } else {
-                // Unquoted variable or expression - read until space or semicolon or end
-                char *dest = tokens[*token_count].value;
-                while (*line && *line != ';' && *line != ' ' && *line != '\t') {
-                    *dest++ = *line++;
-                }
-                *dest = '\0';
-                
-                if (strlen(tokens[*token_count].value) > 0) {
-                    tokens[*token_count].type = TOKEN_PRINT;
-                    tokens[*token_count].has_semicolon = 0;  // Reset semicolon flag
-                    (*token_count)++;
-                    
-                    // Check for semicolon after unquoted item
-                    while (*line == ' ' || *line == '\t') {
-                        line++;
-                    }
-                    if (*line == ';') {
-                        tokens[*token_count - 1].has_semicolon = 1;  // Mark previous token as having semicolon
-                        line++;
-                        while (*line == ' ' || *line == '\t') {
-                            line++;
-                        }
-                    }
-                }
-            }
+        if (i == KEYWORD_COUNT) {
+            keyword_seed = seed;
+            return;
         }
     }
-    // Check for LET
-    else if (strncmp(command, "LET", 3) == 0) {
-        tokens[0].type = TOKEN_LET;
-        strcpy(tokens[0].value, "LET");
-        *token_count = 1;
-        
-        // Get variable assignment: LET x=10 or LET x$="hello"
-        line += 3;  // Skip "LET"
-        while (*line == ' ' || *line == '\t') {
-            line++;  // Skip spaces
-        }
-        
-        // Store the rest as the assignment
-        if (*line != '\0') {
-            strcpy(tokens[1].value, line);
-            tokens[1].type = TOKEN_LET;
-            *token_count = 2;
-        }
+}
+
+TokenType keyword_lookup(const char *text, int *length) {
+    if (keyword_seed == 0) {
+        build_keyword_table();
     }
-    // Check for IF
-    else if (strncmp(command, "IF", 2) == 0) {
-        tokens[0].type = TOKEN_IF;
-        strcpy(tokens[0].value, "IF");
-        *token_count = 1;
-        
-        // Get the condition
-        line += 2;  // Skip "IF"
-        while (*line == ' ' || *line == '\t') {
-            line++;
-        }
-        
-        // Store condition until we find THEN
-        char condition[256];
-        char *cond_ptr = condition;
-        while (*line && strncmp(line, "THEN", 4) != 0 && strncmp(line, "then", 4) != 0) {
-            *cond_ptr++ = *line++;
-        }
-        *cond_ptr = '\0';
-        
-        // Trim trailing spaces from condition
-        while (cond_ptr > condition && *(cond_ptr - 1) == ' ') {
-            *(--cond_ptr) = '\0';
-        }
-        
-        strcpy(tokens[1].value, condition);
-        tokens[1].type = TOKEN_IF;
-        *token_count = 2;
-        
-        // Check for THEN
-        while (*line == ' ' || *line == '\t') {
-            line++;
-        }
-        if (strncmp(line, "THEN", 4) == 0 || strncmp(line, "then", 4) == 0) {
-            tokens[2].type = TOKEN_THEN;
-            strcpy(tokens[2].value, "THEN");
-            line += 4;
-            while (*line == ' ' || *line == '\t') {
-                line++;
-            }
-            
-            // Store command after THEN
-            if (*line != '\0') {
-                strcpy(tokens[3].value, line);
-                tokens[3].type = TOKEN_PRINT;  // Could be any command
-                *token_count = 4;
-            } else {
-                *token_count = 3;
-            }
-        }
+    
+    // Hash the leading word while finding its end
+    uint32_t hash = keyword_seed;
+    int len = 0;
+    while (isalpha((unsigned char)text[len])) {
+        hash = hash_step(hash, text[len]);
+        len++;
     }
-    // Check for INPUT
-    else if (strncmp(command, "INPUT", 5) == 0) {
-        tokens[0].type = TOKEN_INPUT;
-        strcpy(tokens[0].value, "INPUT");
-        *token_count = 1;
-        
-        // Get INPUT arguments
-        line += 5;  // Skip "INPUT"
-        while (*line == ' ' || *line == '\t') {
-            line++;  // Skip spaces
-        }
-        
-        // Check if there's a quoted prompt: INPUT "msg";var
-        char prompt[256] = "? ";
-        char var_name[256];
-        
-        if (*line == '"') {
-            // Has a prompt
-            line++;  // Skip opening quote
-            char *dest = prompt;
-            while (*line && *line != '"') {
-                *dest++ = *line++;
-            }
-            *dest = '\0';  // Null terminate prompt
-            
-            if (*line == '"') line++;  // Skip closing quote
-            
-            // Skip spaces and find semicolon
-            while (*line == ' ' || *line == '\t') {
-                line++;
-            }
-            
-            if (*line == ';') {
-                line++;  // Skip semicolon
-                while (*line == ' ' || *line == '\t') {
-                    line++;
-                }
-                // Get variable name
-                strcpy(var_name, line);
-            }
-        } else {
-            // No prompt, just variable name
-            strcpy(var_name, line);
-        }
-        
-        // Store prompt in token[1] and variable name in token[2]
-        strcpy(tokens[1].value, prompt);
-        tokens[1].type = TOKEN_INPUT;
-        
-        strcpy(tokens[2].value, var_name);
-        tokens[2].type = TOKEN_INPUT;
-        
-        *token_count = 3;
+    *length = len;
+    if (len == 0 || len > MAX_KEYWORD_LEN) {
+        return TOKEN_UNKNOWN;
     }
-    // Check for REM (comment - ignore rest of line)
-    else if (strncmp(command, "REM", 3) == 0) {
-        tokens[0].type = TOKEN_REM;
-        strcpy(tokens[0].value, "REM");
-        *token_count = 1;
+    
+    int index = keyword_table[hash_slot(hash)];
+    if (index == 0) {
+        return TOKEN_UNKNOWN;
     }
-    // Check for LIST
-    else if (strncmp(command, "LIST", 4) == 0) {
-        tokens[0].type = TOKEN_LIST;
-        strcpy(tokens[0].value, "LIST");
-        *token_count = 1;
+    
+    // Confirm the single candidate (case-insensitive, whole word)
+    const char *name = keywords[index - 1].name;
+    for (int i = 0; i < len; i++) {
+        if (name[i] != (text[i] & ~0x20)) {
+            return TOKEN_UNKNOWN;
+        }
     }
-    // Check for RUN
-    else if (strncmp(command, "RUN", 3) == 0) {
-        tokens[0].type = TOKEN_RUN;
-        strcpy(tokens[0].value, "RUN");
-        *token_count = 1;
+    if (name[len] != '\0') {
+        return TOKEN_UNKNOWN;
+    }
+    return keywords[index - 1].type;
+}
+
+int keyword_count(void) {
+    return KEYWORD_COUNT;
+}
+
+const char* keyword_name(int index) {
+    return keywords[index].name;
+}
+
+static const char* skip_spaces(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
     }
-    // Check for NEW
-    else if (strncmp(command, "NEW", 3) == 0) {
-        tokens[0].type = TOKEN_NEW;
-        strcpy(tokens[0].value, "NEW");
-        *token_count = 1;
+    return p;
+}
+
+// End of text without its trailing spaces
+static const char* trim_end(const char *start, const char *end) {
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
     }
-    // Check for FOR
-    else if (strncmp(command, "FOR", 3) == 0) {
-        tokens[0].type = TOKEN_FOR;
-        strcpy(tokens[0].value, "FOR");
-        line += 3;
-        while (*line == ' ' || *line == '\t') line++;
+    return end;
+}
 
-        // Parse format: var=start TO end
-        char *p = (char *)line;
-        char left[256] = {0};
-        char right[256] = {0};
-        char *to_pos = NULL;
-        while (*p) {
-            if ((toupper(*p) == 'T') && (toupper(*(p+1)) == 'O') && (p == line || *(p-1) == ' ' || *(p-1) == '\t')) {
-                to_pos = p;
-                break;
-            }
-            p++;
-        }
-        if (to_pos) {
-            // left part is from line to to_pos - 1
-            size_t left_len = to_pos - line;
-            strncpy(left, line, left_len);
-            left[left_len] = '\0';
-            // right part is after TO
-            p = to_pos + 2; // skip 'TO'
-            while (*p == ' ' || *p == '\t') p++;
-            strncpy(right, p, sizeof(right)-1);
+// Store a token slicing line[start .. end) if the caller left room
+static int add_token(Token *tokens, int max_tokens, int count, TokenType type,
+                     const char *line, const char *start, const char *end) {
+    if (count >= max_tokens) {
+        return count;
+    }
+    tokens[count].type = type;
+    tokens[count].start = start - line;
+    tokens[count].length = end - start;
+    return count + 1;
+}
 
-            // Trim trailing spaces from left
-            char *end = left + strlen(left) - 1;
-            while (end >= left && (*end == ' ' || *end == '\t')) {
-                *end-- = '\0';
-            }
+static int is_word_char(char c) {
+    return isalpha((unsigned char)c) || c == '_' || c == '$';
+}
 
-            // Store in tokens
-            strcpy(tokens[1].value, left);
-            tokens[1].type = TOKEN_FOR;
-            strcpy(tokens[2].value, "TO");
-            tokens[2].type = TOKEN_FOR;
-            strcpy(tokens[3].value, right);
-            tokens[3].type = TOKEN_FOR;
-            *token_count = 4;
-        } else {
-            // No TO found, store entire rest as single token
-            strcpy(tokens[1].value, line);
-            tokens[1].type = TOKEN_FOR;
-            *token_count = 2;
+// Find a keyword such as TO or ELSE inside a statement: case-insensitive,
+// not part of a longer name, and not inside a string literal.
+// Returns NULL if absent
+static const char* find_keyword(const char *p, const char *end, const char *word) {
+    int len = strlen(word);
+    for (const char *start = p; p + len <= end; p++) {
+        if (*p == '"') {
+            // Skip the whole literal
+            for (p++; p < end && *p != '"'; p++);
+            if (p >= end) break;
+            continue;
+        }
+        if ((p == start || !is_word_char(p[-1])) && strncasecmp(p, word, len) == 0 &&
+            (p + len == end || !is_word_char(p[len]))) {
+            return p;
         }
     }
-    // Check for NEXT
-    else if (strncmp(command, "NEXT", 4) == 0) {
-        tokens[0].type = TOKEN_NEXT;
-        strcpy(tokens[0].value, "NEXT");
-        line += 4;
-        while (*line == ' ' || *line == '\t') line++;
-        
-        // Store variable name (optional)
-        if (*line != '\0') {
-            strcpy(tokens[1].value, line);
-            tokens[1].type = TOKEN_NEXT;
-            *token_count = 2;
+    return NULL;
+}
+
+// Find the ELSE of an IF whose THEN part starts at p. An IF nested in the
+// THEN part takes the first ELSE after it, so each ELSE goes with the
+// nearest IF that doesn't have one yet. Returns NULL if absent
+static const char* find_else(const char *p, const char *end) {
+    int nested = 0;
+    while (1) {
+        const char *else_pos = find_keyword(p, end, "ELSE");
+        const char *if_pos = find_keyword(p, end, "IF");
+        if (!else_pos) return NULL;
+        if (if_pos && if_pos < else_pos) {
+            nested++;
+            p = if_pos + 2;
+        } else if (nested > 0) {
+            nested--;
+            p = else_pos + 4;
         } else {
-            *token_count = 1;
+            return else_pos;
         }
     }
-    // Check for WHILE
-    else if (strncmp(command, "WHILE", 5) == 0) {
-        tokens[0].type = TOKEN_WHILE;
-        strcpy(tokens[0].value, "WHILE");
-        line += 5;
-        while (*line == ' ' || *line == '\t') line++;
-        
-        // Store condition
-        strcpy(tokens[1].value, line);
-        tokens[1].type = TOKEN_WHILE;
-        *token_count = 2;
+}
+
+// Filename or path argument: "quoted" or the rest of the statement
+static int add_name(Token *tokens, int max_tokens, int count, TokenType type,
+                    const char *line, const char *p, const char *end) {
+    if (*p == '"') {
+        const char *start = ++p;
+        while (p < end && *p != '"') {
+            p++;
+        }
+        return add_token(tokens, max_tokens, count, type, line, start, p);
     }
-    // Check for WEND
-    else if (strncmp(command, "WEND", 4) == 0) {
-        tokens[0].type = TOKEN_WEND;
-        strcpy(tokens[0].value, "WEND");
-        *token_count = 1;
+    return add_token(tokens, max_tokens, count, type, line, p, end);
+}
+
+// Tokenize the statement in [p, end); token offsets are relative to line
+static int tokenize_span(const char *line, const char *p, const char *end, Token *tokens, int max_tokens) {
+    // Skip leading whitespace; an empty statement has no tokens
+    p = skip_spaces(p, end);
+    end = trim_end(p, end);
+    if (p == end) {
+        return 0;
     }
-    // Check for END
-    else if (strncmp(command, "END", 3) == 0) {
-        tokens[0].type = TOKEN_END;
-        strcpy(tokens[0].value, "END");
-        *token_count = 1;
+    
+    // Classify the leading word in one pass (no copy, no uppercasing)
+    int word_len;
+    TokenType keyword = keyword_lookup(p, &word_len);
+    if (p + word_len > end) {
+        keyword = TOKEN_UNKNOWN;
     }
-    // Check for NOTE
-    else if (strncmp(command, "NOTE", 4) == 0) {
-        tokens[0].type = TOKEN_NOTE;
-        strcpy(tokens[0].value, "NOTE");
-        *token_count = 1;
-        
-        // Get filename and text: NOTE filename text text text
-        line += 4;  // Skip "NOTE"
-        while (*line == ' ' || *line == '\t') line++;
-        
-        // Extract filename (first word)
-        char *dest = tokens[1].value;
-        while (*line && *line != ' ' && *line != '\t') {
-            *dest++ = *line++;
-        }
-        *dest = '\0';
-        
-        if (strlen(tokens[1].value) > 0) {
-            tokens[1].type = TOKEN_NOTE;
-            *token_count = 2;
-            
-            // Skip spaces before text
-            while (*line == ' ' || *line == '\t') line++;
-            
-            // Get remaining text
-            if (*line != '\0') {
-                strcpy(tokens[2].value, line);
-                tokens[2].type = TOKEN_NOTE;
-                *token_count = 3;
-            }
+    
+    if (keyword == TOKEN_UNKNOWN) {
+        if (memchr(p, '=', end - p)) {
+            // Implicit LET (e.g., "x=10" without LET keyword)
+            int count = add_token(tokens, max_tokens, 0, TOKEN_LET, line, p, p);
+            return add_token(tokens, max_tokens, count, TOKEN_LET, line, p, end);
         }
+        return add_token(tokens, max_tokens, 0, TOKEN_UNKNOWN, line, p, end);
     }
-    // Check for SAVE
-    else if (strncmp(command, "SAVE", 4) == 0) {
-        tokens[0].type = TOKEN_SAVE;
-        strcpy(tokens[0].value, "SAVE");
-        line += 4;
-        while (*line == ' ' || *line == '\t') line++;
-        
-        // Get filename (quoted or unquoted)
-        if (*line != '\0') {
-            if (*line == '"') {
-                // Quoted filename
-                line++;
-                char *dest = tokens[1].value;
-                while (*line && *line != '"') {
-                    *dest++ = *line++;
-                }
-                *dest = '\0';
-            } else {
-                // Unquoted filename
-                strcpy(tokens[1].value, line);
+    
+    int count = add_token(tokens, max_tokens, 0, keyword, line, p, p + word_len);
+    p = skip_spaces(p + word_len, end);
+    
+    switch (keyword) {
+        case TOKEN_PRINT:   // Print list; items are parsed by the expression compiler
+        case TOKEN_LET:     // Assignment: LET x=10 or LET x$="hello"
+        case TOKEN_NEXT:    // Optional variable name
+        case TOKEN_GOSUB:   // Target line number
+        case TOKEN_GOTO:
+        case TOKEN_BENCH:   // Optional benchmark name (e.g., BENCH KEYWORDS)
+        case TOKEN_CASE:    // Value list or ELSE
+        case TOKEN_END:     // END SELECT
+        case TOKEN_DEF:     // FNname(args)=expression
+        case TOKEN_DIM:     // Array list: a(10), s$(5, 5)
+        case TOKEN_MAT:     // c=a+b, s=SUM(a), ...
+        case TOKEN_SORT:    // a() DESC, i()
+        case TOKEN_SEARCH:  // a(), value, p
+        case TOKEN_DATA:    // Item list: 1, -2, "text", word
+        case TOKEN_READ:    // Variable list: a, b$, c(i)
+        case TOKEN_RESTORE: // Optional line number
+            if (p < end) {
+                count = add_token(tokens, max_tokens, count, keyword, line, p, end);
             }
-            tokens[1].type = TOKEN_SAVE;
-            *token_count = 2;
-        } else {
-            *token_count = 1;
-        }
-    }
-    // Check for LOAD
-    else if (strncmp(command, "LOAD", 4) == 0) {
-        tokens[0].type = TOKEN_LOAD;
-        strcpy(tokens[0].value, "LOAD");
-        line += 4;
-        while (*line == ' ' || *line == '\t') line++;
-        
-        // Get filename (quoted or unquoted)
-        if (*line != '\0') {
-            if (*line == '"') {
-                // Quoted filename
-                line++;
-                char *dest = tokens[1].value;
-                while (*line && *line != '"') {
-                    *dest++ = *line++;
-                }
-                *dest = '\0';
-            } else {
-                // Unquoted filename
-                strcpy(tokens[1].value, line);
+            break;
+        case TOKEN_WHILE:
+            // Condition
+            count = add_token(tokens, max_tokens, count, TOKEN_WHILE, line, p, end);
+            break;
+        case TOKEN_ON: {
+            // ON expr GOTO|GOSUB line, line, ...
+            const char *jump = find_keyword(p, end, "GOTO");
+            const char *gosub = find_keyword(p, end, "GOSUB");
+            if (gosub && (!jump || gosub < jump)) {
+                jump = gosub;
             }
-            tokens[1].type = TOKEN_LOAD;
-            *token_count = 2;
-        } else {
-            *token_count = 1;
-        }
-    }
-    // Check for DIR
-    else if (strncmp(command, "DIR", 3) == 0) {
-        tokens[0].type = TOKEN_DIR;
-        strcpy(tokens[0].value, "DIR");
-        line += 3;
-        while (*line == ' ' || *line == '\t') line++;
-        
-        if (*line != '\0') {
-            if (*line == '"') {
-                line++;
-                char *dest = tokens[1].value;
-                while (*line && *line != '"') {
-                    *dest++ = *line++;
-                }
-                *dest = '\0';
-            } else {
-                strcpy(tokens[1].value, line);
+            if (!jump) {
+                count = add_token(tokens, max_tokens, count, TOKEN_ON, line, p, end);
+                break;
             }
-            tokens[1].type = TOKEN_DIR;
-            *token_count = 2;
-        } else {
-            *token_count = 1;
+            int jump_len = (jump == gosub) ? 5 : 4;
+            count = add_token(tokens, max_tokens, count, TOKEN_ON, line, p, trim_end(p, jump));
+            count = add_token(tokens, max_tokens, count, (jump == gosub) ? TOKEN_GOSUB : TOKEN_GOTO,
+                              line, jump, jump + jump_len);
+            count = add_token(tokens, max_tokens, count, TOKEN_ON, line, skip_spaces(jump + jump_len, end), end);
+            break;
         }
-    }
-    // Check for RM
-    else if (strncmp(command, "RM", 2) == 0) {
-        tokens[0].type = TOKEN_RM;
-        strcpy(tokens[0].value, "RM");
-        line += 2;
-        while (*line == ' ' || *line == '\t') line++;
-        
-        if (*line != '\0') {
-            if (*line == '"') {
-                line++;
-                char *dest = tokens[1].value;
-                while (*line && *line != '"') {
-                    *dest++ = *line++;
+        case TOKEN_SELECT:
+            // SELECT CASE expr: keep only the expression
+            if (find_keyword(p, end, "CASE") == p) {
+                p = skip_spaces(p + 4, end);
+                count = add_token(tokens, max_tokens, count, TOKEN_SELECT, line, p, end);
+            }
+            break;
+        case TOKEN_IF: {
+            // IF cond THEN stmt [ELSE stmt]; either statement may be a line number
+            const char *then_pos = find_keyword(p, end, "THEN");
+            if (!then_pos) {
+                count = add_token(tokens, max_tokens, count, TOKEN_IF, line, p, end);
+                break;
+            }
+            count = add_token(tokens, max_tokens, count, TOKEN_IF, line, p, trim_end(p, then_pos));
+            count = add_token(tokens, max_tokens, count, TOKEN_THEN, line, then_pos, then_pos + 4);
+            p = skip_spaces(then_pos + 4, end);
+            
+            const char *else_pos = find_else(p, end);
+            const char *then_end = else_pos ? trim_end(p, else_pos) : end;
+            if (p < then_end) {
+                count = add_token(tokens, max_tokens, count, TOKEN_THEN, line, p, then_end);
+            }
+            if (else_pos) {
+                if (count < 4) {
+                    // ELSE needs the THEN statement's slot filled, even if empty
+                    count = add_token(tokens, max_tokens, count, TOKEN_THEN, line, p, p);
                 }
-                *dest = '\0';
-            } else {
-                strcpy(tokens[1].value, line);
+                const char *else_stmt = skip_spaces(else_pos + 4, end);
+                count = add_token(tokens, max_tokens, count, TOKEN_ELSE, line, else_pos, else_pos + 4);
+                count = add_token(tokens, max_tokens, count, TOKEN_ELSE, line, else_stmt, end);
             }
-            tokens[1].type = TOKEN_RM;
-            *token_count = 2;
-        } else {
-            *token_count = 1;
+            break;
         }
-    }
-    // Check for FORMAT
-    else if (strncmp(command, "FORMAT", 6) == 0) {
-        tokens[0].type = TOKEN_FORMAT;
-        strcpy(tokens[0].value, "FORMAT");
-        line += 6;
-        while (*line == ' ' || *line == '\t') line++;
-        
-        // Get drive ("0:" or "1:")
-        if (*line != '\0') {
-            if (*line == '"') {
-                line++;
-                char *dest = tokens[1].value;
-                while (*line && *line != '"') {
-                    *dest++ = *line++;
+        case TOKEN_INPUT: {
+            // INPUT "msg";var or INPUT var. An empty prompt slice means "? "
+            const char *prompt = p;
+            const char *prompt_end = p;
+            const char *var = p;
+            
+            if (p < end && *p == '"') {
+                prompt = ++p;
+                while (p < end && *p != '"') {
+                    p++;
                 }
-                *dest = '\0';
-            } else {
-                // Parse drive and YES
-                char *space = strchr(line, ' ');
-                if (space) {
-                    strncpy(tokens[1].value, line, space - line);
-                    tokens[1].value[space - line] = '\0';
-                    tokens[1].type = TOKEN_FORMAT;
-                    
-                    // Get YES confirmation
-                    line = space + 1;
-                    while (*line == ' ' || *line == '\t') line++;
-                    strcpy(tokens[2].value, line);
-                    tokens[2].type = TOKEN_FORMAT;
-                    *token_count = 3;
-                } else {
-                    strcpy(tokens[1].value, line);
-                    tokens[1].type = TOKEN_FORMAT;
-                    *token_count = 2;
+                prompt_end = p;
+                if (p < end) p++;  // Skip closing quote
+                
+                p = skip_spaces(p, end);
+                var = end;  // No semicolon: no variable
+                if (p < end && *p == ';') {
+                    var = skip_spaces(p + 1, end);
                 }
-                return tokens;
             }
-            tokens[1].type = TOKEN_FORMAT;
-            *token_count = 2;
-        } else {
-            *token_count = 1;
+            count = add_token(tokens, max_tokens, count, TOKEN_INPUT, line, prompt, prompt_end);
+            count = add_token(tokens, max_tokens, count, TOKEN_INPUT, line, var, end);
+            break;
         }
-    }
-    // Check for CD
-    else if (strncmp(command, "CD", 2) == 0) {
-        tokens[0].type = TOKEN_CD;
-        strcpy(tokens[0].value, "CD");
-        line += 2;
-        while (*line == ' ' || *line == '\t') line++;
-        
-        if (*line != '\0') {
-            if (*line == '"') {
-                line++;
-                char *dest = tokens[1].value;
-                while (*line && *line != '"') {
-                    *dest++ = *line++;
-                }
-                *dest = '\0';
-            } else {
-                strcpy(tokens[1].value, line);
+        case TOKEN_FOR: {
+            // Parse format: var=start TO end [STEP step]
+            // TO is looked for after the '=' so a variable such as "total" isn't split
+            const char *eq = memchr(p, '=', end - p);
+            const char *to_pos = find_keyword(eq ? eq : p, end, "TO");
+            if (!to_pos) {
+                // No TO found, store entire rest as single token
+                count = add_token(tokens, max_tokens, count, TOKEN_FOR, line, p, end);
+                break;
             }
-            tokens[1].type = TOKEN_CD;
-            *token_count = 2;
-        } else {
-            *token_count = 1;
+            
+            // Left part without trailing spaces, then TO, then the limit
+            const char *right = skip_spaces(to_pos + 2, end);
+            const char *step_pos = find_keyword(right, end, "STEP");
+            count = add_token(tokens, max_tokens, count, TOKEN_FOR, line, p, trim_end(p, to_pos));
+            count = add_token(tokens, max_tokens, count, TOKEN_TO, line, to_pos, to_pos + 2);
+            count = add_token(tokens, max_tokens, count, TOKEN_FOR, line, right, step_pos ? trim_end(right, step_pos) : end);
+            
+            if (step_pos) {
+                count = add_token(tokens, max_tokens, count, TOKEN_STEP, line, step_pos, step_pos + 4);
+                count = add_token(tokens, max_tokens, count, TOKEN_FOR, line, skip_spaces(step_pos + 4, end), end);
+            }
+            break;
         }
-    }
-    // Check for PWD
-    else if (strncmp(command, "PWD", 3) == 0) {
-        tokens[0].type = TOKEN_PWD;
-        strcpy(tokens[0].value, "PWD");
-        *token_count = 1;
-    }
-    // Check for MKDIR
-    else if (strncmp(command, "MKDIR", 5) == 0) {
-        tokens[0].type = TOKEN_MKDIR;
-        strcpy(tokens[0].value, "MKDIR");
-        line += 5;
-        while (*line == ' ' || *line == '\t') line++;
-        
-        if (*line != '\0') {
-            if (*line == '"') {
-                line++;
-                char *dest = tokens[1].value;
-                while (*line && *line != '"') {
-                    *dest++ = *line++;
+        case TOKEN_NOTE: {
+            // NOTE filename text text text
+            const char *name = p;
+            while (p < end && *p != ' ' && *p != '\t') {
+                p++;
+            }
+            if (p > name) {
+                count = add_token(tokens, max_tokens, count, TOKEN_NOTE, line, name, p);
+                
+                // Remaining text
+                p = skip_spaces(p, end);
+                if (p < end) {
+                    count = add_token(tokens, max_tokens, count, TOKEN_NOTE, line, p, end);
                 }
-                *dest = '\0';
-            } else {
-                strcpy(tokens[1].value, line);
             }
-            tokens[1].type = TOKEN_MKDIR;
-            *token_count = 2;
-        } else {
-            *token_count = 1;
+            break;
         }
-    }
-    // Check for RMDIR
-    else if (strncmp(command, "RMDIR", 5) == 0) {
-        tokens[0].type = TOKEN_RMDIR;
-        strcpy(tokens[0].value, "RMDIR");
-        line += 5;
-        while (*line == ' ' || *line == '\t') line++;
-        
-        if (*line != '\0') {
-            if (*line == '"') {
-                line++;
-                char *dest = tokens[1].value;
-                while (*line && *line != '"') {
-                    *dest++ = *line++;
+        case TOKEN_SAVE:
+        case TOKEN_LOAD:
+        case TOKEN_DIR:
+        case TOKEN_RM:
+        case TOKEN_CD:
+        case TOKEN_MKDIR:
+        case TOKEN_RMDIR:
+            // Filename or path (quoted or unquoted)
+            if (p < end) {
+                count = add_name(tokens, max_tokens, count, keyword, line, p, end);
+            }
+            break;
+        case TOKEN_FORMAT: {
+            // Drive ("0:" or 0:) followed by the YES confirmation
+            if (p >= end) break;
+            const char *drive = p;
+            if (*p == '"') {
+                drive = ++p;
+                while (p < end && *p != '"') {
+                    p++;
                 }
-                *dest = '\0';
+                count = add_token(tokens, max_tokens, count, TOKEN_FORMAT, line, drive, p);
+                if (p < end) p++;
             } else {
-                strcpy(tokens[1].value, line);
+                while (p < end && *p != ' ') {
+                    p++;
+                }
+                count = add_token(tokens, max_tokens, count, TOKEN_FORMAT, line, drive, p);
             }
-            tokens[1].type = TOKEN_RMDIR;
-            *token_count = 2;
-        } else {
-            *token_count = 1;
+            p = skip_spaces(p, end);
+            if (p < end) {
+                count = add_token(tokens, max_tokens, count, TOKEN_FORMAT, line, p, end);
+            }
+            break;
         }
+        default:
+            // REM, LIST, RUN, NEW, WEND, END, PWD, DRIVES, CLS, RETURN take no arguments
+            break;
     }
-    // Check for DRIVES
-    else if (strncmp(command, "DRIVES", 6) == 0) {
-        tokens[0].type = TOKEN_DRIVES;
-        strcpy(tokens[0].value, "DRIVES");
-        *token_count = 1;
-    }
-    // Check for CLS (clear screen)
-    else if (strncmp(command, "CLS", 3) == 0) {
-        tokens[0].type = TOKEN_CLS;
-        strcpy(tokens[0].value, "CLS");
-        *token_count = 1;
-    }
-    // Check for GOSUB
-    else if (strncmp(command, "GOSUB", 5) == 0) {
-        tokens[0].type = TOKEN_GOSUB;
-        strcpy(tokens[0].value, "GOSUB");
-        *token_count = 1;
-        
-        // Get target line number
-        line += 5;  // Skip "GOSUB"
-        while (*line == ' ' || *line == '\t') line++;
-        
-        char *dest = tokens[1].value;
-        while (*line && *line != '\0') {
-            *dest++ = *line++;
-        }
-        *dest = '\0';
-        
-        if (strlen(tokens[1].value) > 0) {
-            tokens[1].type = TOKEN_GOSUB;
-            *token_count = 2;
-        }
+    
+    return count;
+}
+
+int tokenize(const char *line, Token *tokens, int max_tokens) {
+    return tokenize_span(line, line, line + strlen(line), tokens, max_tokens);
+}
+
+int tokenize_range(const char *line, int start, int end, Token *tokens, int max_tokens) {
+    return tokenize_span(line, line + start, line + end, tokens, max_tokens);
+}
+
+int statement_end(const char *line, int start, int end) {
+    const char *p = skip_spaces(line + start, line + end);
+    int word_len;
+    switch (keyword_lookup(p, &word_len)) {
+        // Comments, free text and paths (which may hold "0:") run to the end
+        // of the line, and IF takes the rest of the line as its THEN/ELSE parts
+        case TOKEN_REM:
+        case TOKEN_NOTE:
+        case TOKEN_IF:
+        case TOKEN_SAVE:
+        case TOKEN_LOAD:
+        case TOKEN_DIR:
+        case TOKEN_RM:
+        case TOKEN_FORMAT:
+        case TOKEN_CD:
+        case TOKEN_MKDIR:
+        case TOKEN_RMDIR:
+            return end;
+        default:
+            break;
     }
-    // Check for GOTO
-    else if (strncmp(command, "GOTO", 4) == 0) {
-        tokens[0].type = TOKEN_GOTO;
-        strcpy(tokens[0].value, "GOTO");
-        *token_count = 1;
-        
-        // Get target line number
-        line += 4;  // Skip "GOTO"
-        while (*line == ' ' || *line == '\t') line++;
-        
-        char *dest = tokens[1].value;
-        while (*line && *line != '\0') {
-            *dest++ = *line++;
-        }
-        *dest = '\0';
-        
-        if (strlen(tokens[1].value) > 0) {
-            tokens[1].type = TOKEN_GOTO;
-            *token_count = 2;
+    
+    for (; p < line + end; p++) {
+        if (*p == '"') {
+            // Colons inside string literals don't separate statements
+            for (p++; p < line + end && *p != '"'; p++);
+            if (p >= line + end) break;
+        } else if (*p == ':') {
+            return p - line;
         }
     }
-    // Check for RETURN
-    else if (strncmp(command, "RETURN", 6) == 0) {
-        tokens[0].type = TOKEN_RETURN;
-        strcpy(tokens[0].value, "RETURN");
-        *token_count = 1;
-    }
-    // Check for implicit LET (e.g., "x=10" without LET keyword)
-    else if (strchr(line, '=')) {
-        tokens[0].type = TOKEN_LET;
-        strcpy(tokens[0].value, "LET");
-        strcpy(tokens[1].value, line);
-        tokens[1].type = TOKEN_LET;
-        *token_count = 2;
-    }
-    else {
-        tokens[0].type = TOKEN_UNKNOWN;
-        strcpy(tokens[0].value, line);
-        *token_count = 1;
-    }
-    
-    return tokens;
+    return end;
+}
+
+const char* token_text(const char *line, const Token *token, char *buf, int size) {
+    const char *text = line + token->start;
+    if (text[token->length] == '\0') {
+        return text;
+    }
+    int len = token->length < size - 1 ? token->length : size - 1;
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+    return buf;
 }
 
-void free_tokens(Token *tokens) {
-    free(tokens);
+int token_equals(const char *line, const Token *token, const char *word) {
+    int len = strlen(word);
+    return token->length == len && strncmp(line + token->start, word, len) == 0;
 }
@@ -1,12 +1,15 @@
 #ifndef TOKEN_H
 #define TOKEN_H
 
+#include <stdint.h>
+
 // Token types we support
 typedef enum {
     TOKEN_PRINT,
     TOKEN_LET,
     TOKEN_IF,
     TOKEN_THEN,
+    TOKEN_ELSE,
     TOKEN_INPUT,
     TOKEN_REM,
     TOKEN_LIST,
@@ -14,6 +17,7 @@ typedef enum {
     TOKEN_NEW,
     TOKEN_FOR,
     TOKEN_TO,
+    TOKEN_STEP,
     TOKEN_NEXT,
     TOKEN_WHILE,
     TOKEN_WEND,
@@ -33,22 +37,62 @@ typedef enum {
     TOKEN_GOTO,
     TOKEN_END,
     TOKEN_NOTE,
+    TOKEN_BENCH,
+    TOKEN_ON,
+    TOKEN_SELECT,
+    TOKEN_CASE,
+    TOKEN_DEF,
+    TOKEN_DIM,
+    TOKEN_MEM,
+    TOKEN_MAT,
+    TOKEN_SORT,
+    TOKEN_SEARCH,
+    TOKEN_DATA,
+    TOKEN_READ,
+    TOKEN_RESTORE,
     TOKEN_UNKNOWN,
     TOKEN_EOF,
 } TokenType;
 
-// A single token
+// Most tokens tokenize() produces for one statement
+// (FOR v=a TO b STEP c, IF c THEN s ELSE s)
+#define MAX_TOKENS 6
+
+// A single token: a slice of the source line rather than a copy of it
 typedef struct {
-    TokenType type;
-    char value[256];  // The text/data for this token
-    int has_semicolon;  // 1 if followed by semicolon (suppress newline)
-    int is_string_literal;  // 1 if this was a quoted string
+    uint8_t type;      // TokenType, in a byte: stored lines keep every token
+    uint16_t start;    // Offset of the text within the line given to tokenize()
+    uint16_t length;   // Length of the text
 } Token;
 
-// Parse a line and return the tokens
-Token* tokenize(const char *line, int *token_count);
+// Split a line into tokens, filling the caller's array (no allocation).
+// Returns the number of tokens stored, never more than max_tokens.
+int tokenize(const char *line, Token *tokens, int max_tokens);
+
+// Tokenize the statement in line[start .. end), such as one of several
+// statements on a line or the part after THEN. Offsets stay relative to line
+int tokenize_range(const char *line, int start, int end, Token *tokens, int max_tokens);
+
+// Where the statement starting at line[start] ends: the offset of the next
+// ':' outside string literals, or end. REM, IF, NOTE and the file commands
+// take the rest of the line
+int statement_end(const char *line, int start, int end);
+
+// The text of a token as a C string. A slice that runs to the end of the
+// line is returned in place; anything else is copied into buf.
+const char* token_text(const char *line, const Token *token, char *buf, int size);
+
+// Check whether a token's text is exactly word (case-sensitive)
+int token_equals(const char *line, const Token *token, const char *word);
+
+// Classify the statement keyword at the start of text (case-insensitive).
+// *length receives the length of the leading word. Returns TOKEN_UNKNOWN if
+// the word isn't a keyword, so identifiers such as "ending" or "cdx" aren't
+// mistaken for END or CD.
+TokenType keyword_lookup(const char *text, int *length);
 
-// Free allocated token memory
-void free_tokens(Token *tokens);
+// Keyword table access (for BENCH KEYWORDS)
+int keyword_count(void);
+const char* keyword_name(int index);
 
 #endif
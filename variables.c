@@ -1,171 +1,475 @@
 #include "variables.h"
+#include "expr.h"
+#include "strheap.h"
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdio.h>
 
-#define MAX_VARS 50
 #define MAX_VAR_NAME 50
-#define MAX_VAR_VALUE 256
+#define INITIAL_VARS 64
+#define INITIAL_ARRAYS 8
 
 typedef struct {
-    char name[MAX_VAR_NAME];      // "x" or "x$"
-    char value[MAX_VAR_VALUE];    // "10" or "hello"
-    int is_string;                // 1 if string, 0 if number
+    char *name;           // "x" or "x$"
+    const char *str;      // String value (string heap, shared), NULL for numbers
+    int32_t num;          // Numeric value
+    int next;             // Next slot in the same hash bucket, -1 at the end
+    uint8_t is_string;    // 1 if string, 0 if number
+    uint8_t defined;      // 0 while the slot is only reserved by compiled code
 } Variable;
 
-static Variable vars[MAX_VARS];
+// DIM'd array: elements are stored contiguously, row by row, natively typed
+typedef struct {
+    char *name;                     // "a" or "s$", without the parentheses
+    int32_t dims[MAX_ARRAY_DIMS];   // Elements along each dimension (DIM bound + 1)
+    uint8_t dim_count;              // 0 while only reserved by compiled code
+    uint8_t is_string;
+    int32_t length;                 // Element count
+    int32_t *nums;                  // Numeric elements
+    const char **strs;              // String elements (string heap, NULL reads as "")
+} Array;
+
+// Variables live in one growable array; slots are indices into it, so they
+// stay valid when the array moves. A chained hash over the names finds them.
+static Variable *vars = NULL;
 static int var_count = 0;
+static int var_capacity = 0;
+static int *buckets = NULL;
+static int bucket_count = 0;   // Always a power of two
+
+// Arrays are looked up by name only when code is compiled, so a list will do
+static Array *arrays = NULL;
+static int array_count = 0;
+static int array_capacity = 0;
+
+static uint32_t hash_name(const char *name) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int rehash(int new_bucket_count) {
+    int *grown = realloc(buckets, sizeof(int) * new_bucket_count);
+    if (!grown) return -1;
+    buckets = grown;
+    bucket_count = new_bucket_count;
+    
+    for (int i = 0; i < bucket_count; i++) {
+        buckets[i] = -1;
+    }
+    for (int slot = 0; slot < var_count; slot++) {
+        uint32_t b = hash_name(vars[slot].name) & (bucket_count - 1);
+        vars[slot].next = buckets[b];
+        buckets[b] = slot;
+    }
+    return 0;
+}
+
+// Compaction moved the strings: follow them
+static void relocate_strings(void) {
+    for (int i = 0; i < var_count; i++) {
+        strheap_relocate(&vars[i].str);
+    }
+    for (int i = 0; i < array_count; i++) {
+        if (arrays[i].strs) {
+            for (int32_t j = 0; j < arrays[i].length; j++) {
+                strheap_relocate(&arrays[i].strs[j]);
+            }
+        }
+    }
+}
 
 void var_init(void) {
+    for (int i = 0; i < var_count; i++) {
+        free(vars[i].name);
+    }
     var_count = 0;
-    memset(vars, 0, sizeof(vars));
+    for (int i = 0; i < array_count; i++) {
+        free(arrays[i].name);
+        free(arrays[i].nums);
+        free(arrays[i].strs);
+    }
+    array_count = 0;
+    strheap_init();  // Every string belonged to a variable or an array
+    strheap_set_roots(relocate_strings);
+    for (int i = 0; i < bucket_count; i++) {
+        buckets[i] = -1;
+    }
 }
 
 static int find_var(const char *name) {
-    for (int i = 0; i < var_count; i++) {
-        if (strcmp(vars[i].name, name) == 0) {
-            return i;
+    if (bucket_count == 0) return -1;
+    
+    int slot = buckets[hash_name(name) & (bucket_count - 1)];
+    while (slot >= 0) {
+        if (strcmp(vars[slot].name, name) == 0) {
+            return slot;
         }
+        slot = vars[slot].next;
     }
     return -1;
 }
 
-void var_set(const char *assignment) {
-    // Parse "x=10" or "x$=\"hello\"" or "x=y+5"
-    char name[MAX_VAR_NAME];
-    char value[MAX_VAR_VALUE];
-    int is_string = 0;
+static int name_is_string(const char *name) {
+    int len = strlen(name);
+    return len > 0 && name[len - 1] == '$';
+}
+
+int var_slot(const char *name) {
+    int slot = find_var(name);
+    if (slot >= 0) {
+        return slot;
+    }
+    if (strlen(name) >= MAX_VAR_NAME) {
+        return -1;
+    }
     
-    // Find the = sign
-    const char *eq = strchr(assignment, '=');
-    if (!eq) return;
+    if (var_count >= var_capacity) {
+        int new_capacity = var_capacity ? var_capacity * 2 : INITIAL_VARS;
+        Variable *grown = realloc(vars, sizeof(Variable) * new_capacity);
+        if (!grown) return -1;
+        vars = grown;
+        var_capacity = new_capacity;
+    }
     
-    // Extract variable name (trim spaces)
-    strncpy(name, assignment, eq - assignment);
-    name[eq - assignment] = '\0';
+    char *copy = strdup(name);
+    if (!copy) return -1;
     
-    // Trim trailing spaces from name
-    int len = strlen(name);
-    while (len > 0 && name[len - 1] == ' ') {
-        name[--len] = '\0';
+    // Reserve an undefined slot; it reads as 0 or "" until assigned
+    slot = var_count++;
+    vars[slot].name = copy;
+    vars[slot].str = NULL;
+    vars[slot].num = 0;
+    vars[slot].is_string = name_is_string(name);
+    vars[slot].defined = 0;
+    
+    // Keep chains short: one bucket per variable
+    if (var_count > bucket_count) {
+        if (rehash(bucket_count ? bucket_count * 2 : INITIAL_VARS) != 0) {
+            free(copy);
+            var_count--;
+            return -1;
+        }
+    } else {
+        uint32_t b = hash_name(name) & (bucket_count - 1);
+        vars[slot].next = buckets[b];
+        buckets[b] = slot;
     }
+    return slot;
+}
+
+const char* var_slot_name(int slot) {
+    return vars[slot].name;
+}
+
+int var_defined(int slot) {
+    return vars[slot].defined;
+}
+
+int32_t var_get_number_slot(int slot) {
+    return vars[slot].num;
+}
+
+const char* var_get_string_slot(int slot) {
+    return vars[slot].str ? vars[slot].str : "";
+}
+
+void var_set_number_slot(int slot, int32_t value) {
+    vars[slot].num = value;
+    vars[slot].defined = 1;
+}
+
+// Replace *held with s, which already holds a reference for it
+static void replace_string(const char **held, const char *s) {
+    strheap_release(*held);
+    *held = s;
+}
+
+// The string a value refers to, as a reference of its own. A whole heap
+// string is shared; anything else is copied, so a value that is part of the
+// string it's about to replace (a$=MID$(a$, 2)) is safe. NULL if out of space
+static const char* hold_string(const Value *value) {
+    return value->in_heap ? strheap_share(value->str) : strheap_alloc(value->str, value->len);
+}
+
+// Replace the slot's string with s, which already holds a reference for it
+static void store_string(int slot, const char *s) {
+    replace_string(&vars[slot].str, s);
+    vars[slot].defined = 1;
+}
+
+void var_set_string_slot(int slot, const char *value) {
+    // a$=a$ hands us our own string
+    if (vars[slot].str == value) {
+        vars[slot].defined = 1;
+        return;
+    }
+    const char *copy = strheap_alloc(value, strlen(value));
+    if (copy) {
+        store_string(slot, copy);
+    }
+}
+
+void var_assign_slot(int slot, const Value *value) {
+    if (vars[slot].is_string != value->is_string) {
+        printf("?TYPE MISMATCH\n");
+        return;
+    }
+    if (!value->is_string) {
+        var_set_number_slot(slot, value->num);
+        return;
+    }
+    // a$=b$ takes another reference to b$'s string: no copy
+    const char *s = hold_string(value);
+    if (s) {
+        store_string(slot, s);
+    }
+}
+
+void var_set_number(const char *name, int32_t value) {
+    int slot = var_slot(name);
+    if (slot >= 0) {
+        var_set_number_slot(slot, value);
+    }
+}
+
+void var_set_string(const char *name, const char *value) {
+    int slot = var_slot(name);
+    if (slot >= 0) {
+        var_set_string_slot(slot, value);
+    }
+}
+
+void var_assign(const char *name, const Value *value) {
+    int slot = var_slot(name);
+    if (slot < 0) {
+        printf("?OUT OF MEMORY\n");
+        return;
+    }
+    var_assign_slot(slot, value);
+}
+
+int var_array_slot(const char *name) {
+    for (int i = 0; i < array_count; i++) {
+        if (strcmp(arrays[i].name, name) == 0) {
+            return i;
+        }
+    }
+    if (strlen(name) >= MAX_VAR_NAME) {
+        return -1;
+    }
+    if (array_count >= array_capacity) {
+        int new_capacity = array_capacity ? array_capacity * 2 : INITIAL_ARRAYS;
+        Array *grown = realloc(arrays, sizeof(Array) * new_capacity);
+        if (!grown) return -1;
+        arrays = grown;
+        array_capacity = new_capacity;
+    }
+    char *copy = strdup(name);
+    if (!copy) return -1;
     
-    // Check if it's a string variable (ends with $)
-    if (len > 0 && name[len - 1] == '$') {
-        is_string = 1;
+    Array *array = &arrays[array_count];
+    memset(array, 0, sizeof(Array));
+    array->name = copy;
+    array->is_string = name_is_string(name);
+    return array_count++;
+}
+
+const char* var_array_name(int slot) {
+    return arrays[slot].name;
+}
+
+int var_dim(int slot, const int32_t *bounds, int count) {
+    Array *array = &arrays[slot];
+    if (array->dim_count) {
+        printf("?REDIM'D ARRAY\n");
+        return -1;
+    }
+    if (count < 1 || count > MAX_ARRAY_DIMS) {
+        printf("?SYNTAX ERROR\n");
+        return -1;
+    }
+    int32_t length = 1;
+    for (int i = 0; i < count; i++) {
+        if (bounds[i] < 0 || bounds[i] >= INT32_MAX / 4 / length) {
+            printf("?ILLEGAL QUANTITY\n");
+            return -1;
+        }
+        length *= bounds[i] + 1;
     }
     
-    // Extract value (skip = and leading spaces)
-    const char *val_start = eq + 1;
-    while (*val_start == ' ' || *val_start == '\t') {
-        val_start++;
+    // calloc: numbers start at 0, strings at NULL ("")
+    if (array->is_string) {
+        array->strs = calloc(length, sizeof(const char *));
+    } else {
+        array->nums = calloc(length, sizeof(int32_t));
+    }
+    if (!array->strs && !array->nums) {
+        printf("?OUT OF MEMORY\n");
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        array->dims[i] = bounds[i] + 1;
+    }
+    array->dim_count = count;
+    array->length = length;
+    return 0;
+}
+
+int32_t var_array_index(int slot, const int32_t *subscripts, int count) {
+    const Array *array = &arrays[slot];
+    if (array->dim_count == 0) {
+        printf("?UNDIM'D ARRAY %s\n", array->name);
+        return -1;
+    }
+    if (count != array->dim_count) {
+        printf("?SUBSCRIPT OUT OF RANGE\n");
+        return -1;
+    }
+    int32_t index = 0;
+    for (int i = 0; i < count; i++) {
+        // One unsigned compare also catches negative subscripts
+        if ((uint32_t)subscripts[i] >= (uint32_t)array->dims[i]) {
+            printf("?SUBSCRIPT OUT OF RANGE\n");
+            return -1;
+        }
+        index = index * array->dims[i] + subscripts[i];
+    }
+    return index;
+}
+
+void var_array_get(int slot, int32_t index, Value *value) {
+    const Array *array = &arrays[slot];
+    value->is_string = array->is_string;
+    if (!array->is_string) {
+        value->num = array->nums[index];
+        return;
+    }
+    const char *s = array->strs[index];
+    value->str = s ? s : "";
+    value->len = s ? strheap_length(s) : 0;
+    value->in_heap = (s != NULL);
+}
+
+void var_array_set(int slot, int32_t index, const Value *value) {
+    Array *array = &arrays[slot];
+    if (array->is_string != value->is_string) {
+        printf("?TYPE MISMATCH\n");
+        return;
+    }
+    if (!array->is_string) {
+        array->nums[index] = value->num;
+        return;
     }
+    const char *s = hold_string(value);
+    if (s) {
+        replace_string(&array->strs[index], s);
+    }
+}
+
+int32_t* var_array_numbers(int slot, int32_t *length) {
+    *length = arrays[slot].length;
+    return arrays[slot].nums;
+}
+
+const char** var_array_strings(int slot, int32_t *length) {
+    *length = arrays[slot].length;
+    return arrays[slot].strs;
+}
+
+int var_count_defined(void) {
+    int count = 0;
+    for (int i = 0; i < var_count; i++) {
+        count += vars[i].defined;
+    }
+    return count;
+}
+
+int var_array_count(void) {
+    int count = 0;
+    for (int i = 0; i < array_count; i++) {
+        count += (arrays[i].dim_count != 0);
+    }
+    return count;
+}
+
+int32_t var_array_bytes(void) {
+    int32_t bytes = 0;
+    for (int i = 0; i < array_count; i++) {
+        bytes += arrays[i].length * (arrays[i].is_string ? sizeof(const char *) : sizeof(int32_t));
+    }
+    return bytes;
+}
+
+void var_set(const char *assignment) {
+    // Parse "x=10" or "x$=\"hello\"" or "x=y*2+5" or "a(i, 2)=x"
+    char name[MAX_VAR_NAME];
+    const char *p = assignment;
+    if (expr_parse_name(&p, name, sizeof(name)) != 0) return;
     
-    // Handle quoted strings
-    if (*val_start == '"') {
-        val_start++;  // Skip opening quote
-        char *dest = value;
-        while (*val_start && *val_start != '"') {
-            *dest++ = *val_start++;
+    Expr *index = NULL;
+    int array = -1;
+    if (*p == '(') {
+        array = var_array_slot(name);
+        if (array < 0) {
+            printf("?OUT OF MEMORY\n");
+            return;
         }
-        *dest = '\0';
-        is_string = 1;
-    } else {
-        // Try to evaluate as expression (variable +/- number or variable)
-        strcpy(value, val_start);
-        
-        // Look for arithmetic operators
-        char *plus = strchr(value, '+');
-        char *minus = strchr(value, '-');
-        char *mult = strchr(value, '*');
-        char *divv = strchr(value, '/');
-        
-        // Find the first operator (excluding leading minus)
-        char *op = NULL;
-        char op_char = '\0';
-        if (plus) { op = plus; op_char = '+'; }
-        if (minus && minus != value && (!op || minus < op)) { op = minus; op_char = '-'; }
-        if (mult && (!op || mult < op)) { op = mult; op_char = '*'; }
-        if (divv && (!op || divv < op)) { op = divv; op_char = '/'; }
-        
-        if (op) {
-            // Parse left operand
-            char left_str[256];
-            strncpy(left_str, value, op - value);
-            left_str[op - value] = '\0';
-            
-            // Trim spaces
-            len = strlen(left_str);
-            while (len > 0 && left_str[len - 1] == ' ') left_str[--len] = '\0';
-            len = strlen(left_str);
-            while (len > 0 && left_str[0] == ' ') {
-                memmove(left_str, left_str + 1, strlen(left_str));
-                len--;
-            }
-            
-            // Parse right operand
-            char right_str[256];
-            strcpy(right_str, op + 1);
-            
-            // Trim spaces
-            len = strlen(right_str);
-            while (len > 0 && right_str[0] == ' ') {
-                memmove(right_str, right_str + 1, strlen(right_str));
-                len--;
-            }
-            len = strlen(right_str);
-            while (len > 0 && right_str[len - 1] == ' ') right_str[--len] = '\0';
-            
-            // Get numeric values
-            const char *left_val_str = var_get(left_str);
-            if (left_val_str == NULL) left_val_str = left_str;
-            int left_val = atoi(left_val_str);
-            
-            const char *right_val_str = var_get(right_str);
-            if (right_val_str == NULL) right_val_str = right_str;
-            int right_val = atoi(right_val_str);
-            
-            // Perform operation
-            int result = 0;
-            switch (op_char) {
-                case '+': result = left_val + right_val; break;
-                case '-': result = left_val - right_val; break;
-                case '*': result = left_val * right_val; break;
-                case '/': result = right_val != 0 ? left_val / right_val : 0; break;
-            }
-            
-            snprintf(value, sizeof(value), "%d", result);
-            is_string = 0;
+        index = expr_parse_element(&p, array);
+        if (!index) {
+            printf("%s\n", expr_error());
+            return;
         }
     }
+    if (*p != '=') {
+        expr_free(index);
+        return;
+    }
     
-    // Find or create variable
-    int idx = find_var(name);
-    if (idx >= 0) {
-        // Update existing
-        strcpy(vars[idx].value, value);
-        vars[idx].is_string = is_string;
-    } else if (var_count < MAX_VARS) {
-        // Add new
-        strcpy(vars[var_count].name, name);
-        strcpy(vars[var_count].value, value);
-        vars[var_count].is_string = is_string;
-        var_count++;
+    Expr *expr = expr_compile(p + 1);
+    if (!expr) {
+        printf("%s\n", expr_error());
+        expr_free(index);
+        return;
+    }
+    
+    // The element first: evaluating it would clear a string the value built
+    Value value;
+    int32_t element = 0;
+    if ((!index || expr_eval_number(index, &element) == 0) && expr_eval(expr, &value) == 0) {
+        if (index) {
+            var_array_set(array, element, &value);
+        } else {
+            var_assign(name, &value);
+        }
     }
+    expr_free(expr);
+    expr_free(index);
 }
 
 const char* var_get(const char *name) {
+    // Compatibility: numbers come back as text in a shared buffer
+    static char number_text[16];
+    
     int idx = find_var(name);
-    if (idx >= 0) {
-        return vars[idx].value;
+    if (idx < 0 || !vars[idx].defined) {
+        return NULL;
+    }
+    if (vars[idx].is_string) {
+        return var_get_string_slot(idx);
     }
-    return NULL;
+    snprintf(number_text, sizeof(number_text), "%ld", (long)vars[idx].num);
+    return number_text;
 }
 
 int var_is_string(const char *name) {
     int idx = find_var(name);
-    if (idx >= 0) {
+    if (idx >= 0 && vars[idx].defined) {
         return vars[idx].is_string;
     }
     return 0;
@@ -173,7 +477,7 @@ int var_is_string(const char *name) {
 
 int var_is_number(const char *name) {
     int idx = find_var(name);
-    if (idx >= 0) {
+    if (idx >= 0 && vars[idx].defined) {
         return !vars[idx].is_string;
     }
     return 0;
@@ -1,13 +1,77 @@
 #ifndef VARIABLES_H
 #define VARIABLES_H
 
+#include <stdint.h>
+#include "expr.h"
+
 // Initialize variable storage
 void var_init(void);
 
-// Set a variable: x=10 or x$="hello"
+// Set a variable from an assignment: x=10, x=a+b*2, x$="hello" or a(i)=5
 void var_set(const char *assignment);
 
-// Get a variable value: returns pointer to value string
+// Set a numeric or string variable directly
+void var_set_number(const char *name, int32_t value);
+void var_set_string(const char *name, const char *value);
+
+// Assign an evaluated expression; type must match the name ($ suffix = string)
+void var_assign(const char *name, const Value *value);
+
+// Resolve a name to its slot index, reserving the slot if it's new.
+// Compiled code keeps the index so it never looks the name up again.
+// Returns -1 if out of memory.
+int var_slot(const char *name);
+
+// Name of the variable in a slot
+const char* var_slot_name(int slot);
+
+// Check if the variable in a slot has been assigned
+int var_defined(int slot);
+
+// Slot access: numbers are native int32_t, unassigned slots read as 0 or ""
+int32_t var_get_number_slot(int slot);
+const char* var_get_string_slot(int slot);
+void var_set_number_slot(int slot, int32_t value);
+void var_set_string_slot(int slot, const char *value);
+void var_assign_slot(int slot, const Value *value);
+
+// Arrays: DIM a(n) holds a(0) .. a(n), DIM a(n, m) holds n+1 rows of m+1
+#define MAX_ARRAY_DIMS 2
+
+// Resolve an array name ("a" or "s$") to its slot, reserving it if it's
+// new. Returns -1 if out of memory
+int var_array_slot(const char *name);
+
+// Name of the array in a slot, without the parentheses
+const char* var_array_name(int slot);
+
+// DIM the array in slot with the given upper bounds. Elements start as 0
+// or "". Returns -1 on error (message printed), e.g. if it's already DIM'd
+int var_dim(int slot, const int32_t *bounds, int count);
+
+// Position of an element within its array. Returns -1 (message printed)
+// if the subscripts don't fit the array's DIM
+int32_t var_array_index(int slot, const int32_t *subscripts, int count);
+
+// Read or write the element at a position from var_array_index
+void var_array_get(int slot, int32_t index, Value *value);
+void var_array_set(int slot, int32_t index, const Value *value);
+
+// Element storage of a numeric array, in row order, and its element count.
+// NULL for a string array or one that hasn't been DIM'd
+int32_t* var_array_numbers(int slot, int32_t *length);
+
+// Element storage of a string array (string heap, NULL reads as ""), for
+// reordering in place. NULL for a numeric array or one that hasn't been DIM'd
+const char** var_array_strings(int slot, int32_t *length);
+
+// Memory use: assigned variables, DIM'd arrays and their element storage
+int var_count_defined(void);
+int var_array_count(void);
+int32_t var_array_bytes(void);
+
+// Get a variable value as text (numbers are formatted into a shared buffer)
+// Returns NULL if the variable doesn't exist
 const char* var_get(const char *name);
 
 // Check if variable is a string (ends with $)
@@ -0,0 +1,490 @@
+#include "vm.h"
+#include "compiler.h"
+#include "execute.h"
+#include "loops.h"
+#include "variables.h"
+#include "data.h"
+#include "mat.h"
+#include "sort.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// Direct threading needs labels as values (GCC, Clang). Define
+// VM_SWITCH_DISPATCH to build the portable switch loop instead
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define VM_THREADED 1
+#endif
+
+// GCC otherwise merges every handler's "goto *" back into one shared jump,
+// which undoes the threading
+#if defined(VM_THREADED) && !defined(__clang__)
+#define VM_KEEP_JUMPS __attribute__((optimize("no-crossjumping", "no-gcse")))
+#else
+#define VM_KEEP_JUMPS
+#endif
+
+// Kept between runs so RUN doesn't reallocate the instruction array every time
+static CompiledProgram compiled;
+
+// Set while vm_run() is executing compiled, which nothing may recompile then
+static int running = 0;
+
+// Set by a RUN in the program: vm_run() starts it over once this run returns
+static int rerun = 0;
+
+static void let(const Instr *in) {
+    Value value;
+    if (expr_eval(in->expr, &value) == 0) {
+        var_assign_slot(in->slot, &value);
+    }
+}
+
+static void let_element(const Instr *in) {
+    // The position first: evaluating it would clear a string the value built
+    int32_t index;
+    Value value;
+    if (expr_eval_number(in->index, &index) == 0 && expr_eval(in->expr, &value) == 0) {
+        var_array_set(in->slot, index, &value);
+    }
+}
+
+// Returns -1 (message printed) if the next DATA item can't be read, which
+// stops the program
+static int read_data(const Instr *in) {
+    int32_t index = 0;
+    Value value;
+    if (in->index && expr_eval_number(in->index, &index) != 0) {
+        return 0;
+    }
+    if (data_read(&value, in->imm) != 0) {
+        return -1;
+    }
+    if (in->index) {
+        var_array_set(in->slot, index, &value);
+    } else {
+        var_assign_slot(in->slot, &value);
+    }
+    return 0;
+}
+
+static void dim(const Instr *in) {
+    int32_t bounds[MAX_ARRAY_DIMS];
+    if (expr_eval_number(in->expr, &bounds[0]) == 0 &&
+        (!in->limit || expr_eval_number(in->limit, &bounds[1]) == 0)) {
+        var_dim(in->slot, bounds, in->limit ? 2 : 1);
+    }
+}
+
+// Storage of the numeric array in slot, for MAT. NULL (message printed)
+// if it hasn't been DIM'd
+static int32_t* mat_array(int slot, int32_t *length) {
+    int32_t *data = var_array_numbers(slot, length);
+    if (!data) {
+        printf("?UNDIM'D ARRAY %s\n", var_array_name(slot));
+    }
+    return data;
+}
+
+static void mat(const Instr *in) {
+    int32_t n, na, nb, k;
+    int32_t *dst = NULL;
+    if (in->arg < MAT_SUM && !(dst = mat_array(in->slot, &n))) {
+        return;
+    }
+    int32_t *a = mat_array(in->source[0], &na);
+    if (!a) return;
+    int32_t *b = NULL;
+    if (in->arg == MAT_ADD || in->arg == MAT_SUB || in->arg == MAT_DOT) {
+        b = mat_array(in->source[1], &nb);
+        if (!b) return;
+        if (nb != na) {
+            printf("?DIMENSION MISMATCH\n");
+            return;
+        }
+    }
+    if (dst && n != na) {
+        printf("?DIMENSION MISMATCH\n");
+        return;
+    }
+    
+    switch (in->arg) {
+        case MAT_COPY:  mat_copy(dst, a, n); break;
+        case MAT_ADD:   mat_add(dst, a, b, n); break;
+        case MAT_SUB:   mat_sub(dst, a, b, n); break;
+        case MAT_SCALE:
+            if (expr_eval_number(in->expr, &k) == 0) {
+                mat_scale(dst, a, k, n);
+            }
+            break;
+        case MAT_SUM:   var_set_number_slot(in->slot, mat_sum(a, na)); break;
+        case MAT_MIN:   var_set_number_slot(in->slot, mat_min(a, na)); break;
+        case MAT_MAX:   var_set_number_slot(in->slot, mat_max(a, na)); break;
+        case MAT_DOT:   var_set_number_slot(in->slot, mat_dot(a, b, na)); break;
+    }
+}
+
+// Element count of the array in slot, for SORT and SEARCH. -1 (message
+// printed) if it hasn't been DIM'd
+static int32_t sort_length(int slot) {
+    int32_t n;
+    if (var_array_numbers(slot, &n) || var_array_strings(slot, &n)) {
+        return n;
+    }
+    printf("?UNDIM'D ARRAY %s\n", var_array_name(slot));
+    return -1;
+}
+
+static void sort_array(const Instr *in) {
+    int32_t n = sort_length(in->slot);
+    if (n < 0) return;
+    int32_t *order = NULL;
+    if (in->source[0] >= 0) {
+        if (sort_length(in->source[0]) < 0) return;
+        int32_t count;
+        order = var_array_numbers(in->source[0], &count);
+        if (count != n) {
+            printf("?DIMENSION MISMATCH\n");
+            return;
+        }
+    }
+    int32_t *nums = var_array_numbers(in->slot, &n);
+    int status = nums ? sort_numbers(nums, n, in->imm, order)
+                      : sort_strings(var_array_strings(in->slot, &n), n, in->imm, order);
+    if (status != 0) {
+        printf("?OUT OF MEMORY\n");
+    }
+}
+
+static void search_array(const Instr *in) {
+    int32_t n = sort_length(in->source[0]);
+    Value value;
+    if (n < 0 || expr_eval(in->expr, &value) != 0) return;
+    int32_t *nums = var_array_numbers(in->source[0], &n);
+    if (value.is_string != !nums) {
+        printf("?TYPE MISMATCH\n");
+        return;
+    }
+    var_set_number_slot(in->slot, nums ? search_numbers(nums, n, value.num)
+                                       : search_strings(var_array_strings(in->source[0], &n), n, value.str, value.len));
+}
+
+static void inc(const Instr *in) {
+    // Wraps like the expression evaluator's + does
+    var_set_number_slot(in->slot, (int32_t)((uint32_t)var_get_number_slot(in->slot) + (uint32_t)in->imm));
+}
+
+// NEXT on loop_slot (-1: innermost): where to continue, or -1 to stop
+static int next(int loop_slot, int pc) {
+    // Counter, limit and step are native ints in the frame: add, compare, branch
+    int body = loop_for_next(loop_slot);
+    if (body == -2) {
+        return -1;
+    }
+    return (body >= 0) ? body : pc + 1;
+}
+
+const char* vm_dispatch_name(void) {
+#ifdef VM_THREADED
+    return "threaded";
+#else
+    return "switch";
+#endif
+}
+
+VM_KEEP_JUMPS uint32_t vm_run_code(Instr *code, int length) {
+    uint32_t executed = 0;
+    int pc = 0;
+    const Instr *in;
+
+#ifdef VM_THREADED
+#define HANDLER(op) handle_##op
+    // Each instruction carries its handler's address, and every handler ends
+    // by jumping straight to the next instruction's handler
+    static const void *const handlers[] = {
+        [OP_EXEC] = &&HANDLER(OP_EXEC),
+        [OP_CHAIN] = &&HANDLER(OP_CHAIN),
+        [OP_REM] = &&HANDLER(OP_REM),
+        [OP_PRINT] = &&HANDLER(OP_PRINT),
+        [OP_LET] = &&HANDLER(OP_LET),
+        [OP_LET_ELEM] = &&HANDLER(OP_LET_ELEM),
+        [OP_IF] = &&HANDLER(OP_IF),
+        [OP_FOR] = &&HANDLER(OP_FOR),
+        [OP_NEXT] = &&HANDLER(OP_NEXT),
+        [OP_WHILE] = &&HANDLER(OP_WHILE),
+        [OP_WEND] = &&HANDLER(OP_WEND),
+        [OP_JUMP] = &&HANDLER(OP_JUMP),
+        [OP_GOTO] = &&HANDLER(OP_GOTO),
+        [OP_GOSUB] = &&HANDLER(OP_GOSUB),
+        [OP_RETURN] = &&HANDLER(OP_RETURN),
+        [OP_END] = &&HANDLER(OP_END),
+        [OP_ON_GOTO] = &&HANDLER(OP_ON_GOTO),
+        [OP_ON_GOSUB] = &&HANDLER(OP_ON_GOSUB),
+        [OP_SELECT] = &&HANDLER(OP_SELECT),
+        [OP_READ] = &&HANDLER(OP_READ),
+        [OP_RESTORE] = &&HANDLER(OP_RESTORE),
+        [OP_DIM] = &&HANDLER(OP_DIM),
+        [OP_MAT] = &&HANDLER(OP_MAT),
+        [OP_SORT] = &&HANDLER(OP_SORT),
+        [OP_SEARCH] = &&HANDLER(OP_SEARCH),
+        [OP_INC] = &&HANDLER(OP_INC),
+        [OP_INC_IF] = &&HANDLER(OP_INC_IF),
+        [OP_LET_IF] = &&HANDLER(OP_LET_IF),
+        [OP_PRINT_VAR] = &&HANDLER(OP_PRINT_VAR),
+        [OP_LET_NEXT] = &&HANDLER(OP_LET_NEXT),
+        [OP_INC_NEXT] = &&HANDLER(OP_INC_NEXT),
+    };
+    for (int i = 0; i < length; i++) {
+        code[i].handler = handlers[code[i].op];
+    }
+#define DISPATCH() do { \
+        if (execution_interrupted) goto interrupted; \
+        in = &code[pc]; \
+        executed++; \
+        goto *in->handler; \
+    } while (0)
+    
+    DISPATCH();
+    {
+#else
+#define HANDLER(op) case op
+#define DISPATCH() continue
+    (void)length;  // Only threading needs it, to fill in the handlers
+    
+    while (1) {
+        // Check for Ctrl-C interrupt
+        if (execution_interrupted) goto interrupted;
+        in = &code[pc];
+        executed++;
+        
+        switch (in->op) {
+#endif
+        HANDLER(OP_EXEC):
+            execute(in->src->text, in->tokens, in->token_count, in->line_num);
+            pc++;
+            DISPATCH();
+        HANDLER(OP_CHAIN):
+            // NEW/LOAD/RUN replace or re-run the program, so this code is stale.
+            // RUN is left to vm_run(), which can't recompile from in here
+            if (in->tokens[0].type == TOKEN_RUN) {
+                rerun = 1;
+            } else {
+                execute(in->src->text, in->tokens, in->token_count, in->line_num);
+            }
+            return executed;
+        HANDLER(OP_REM):
+            pc++;
+            DISPATCH();
+        HANDLER(OP_PRINT):
+            print_expr(in->expr);
+            if (in->arg) {
+                printf("\n");
+            }
+            pc++;
+            DISPATCH();
+        HANDLER(OP_PRINT_VAR):
+            // PRINT of a single variable reads its slot directly
+            if (in->imm) {
+                printf("%s", var_get_string_slot(in->slot));
+            } else if (!var_defined(in->slot)) {
+                printf("?UNDEFINED VARIABLE: %s", var_slot_name(in->slot));
+            } else {
+                printf("%ld", (long)var_get_number_slot(in->slot));
+            }
+            if (in->arg) {
+                printf("\n");
+            }
+            pc++;
+            DISPATCH();
+        HANDLER(OP_LET):
+            let(in);
+            pc++;
+            DISPATCH();
+        HANDLER(OP_LET_ELEM):
+            let_element(in);
+            pc++;
+            DISPATCH();
+        HANDLER(OP_READ):
+            if (read_data(in) != 0) {
+                return executed;
+            }
+            pc++;
+            DISPATCH();
+        HANDLER(OP_RESTORE):
+            data_seek(in->arg);
+            pc++;
+            DISPATCH();
+        HANDLER(OP_DIM):
+            dim(in);
+            pc++;
+            DISPATCH();
+        HANDLER(OP_MAT):
+            mat(in);
+            pc++;
+            DISPATCH();
+        HANDLER(OP_SORT):
+            sort_array(in);
+            pc++;
+            DISPATCH();
+        HANDLER(OP_SEARCH):
+            search_array(in);
+            pc++;
+            DISPATCH();
+        HANDLER(OP_INC):
+            inc(in);
+            pc++;
+            DISPATCH();
+        HANDLER(OP_IF):
+            // The THEN part follows inline; arg is the ELSE part or the next line
+            pc = expr_eval_condition(in->expr) ? pc + 1 : in->arg;
+            DISPATCH();
+        HANDLER(OP_LET_IF):
+            let(in);
+            pc = expr_eval_condition(in->cond) ? pc + 1 : in->arg;
+            DISPATCH();
+        HANDLER(OP_INC_IF):
+            inc(in);
+            pc = expr_eval_condition(in->cond) ? pc + 1 : in->arg;
+            DISPATCH();
+        HANDLER(OP_JUMP):
+            pc = in->arg;
+            DISPATCH();
+        HANDLER(OP_FOR): {
+            // Loop body starts at the next instruction
+            int32_t start_val, end_val, step = 1;
+            if (expr_eval_number(in->expr, &start_val) != 0 ||
+                expr_eval_number(in->limit, &end_val) != 0 ||
+                (in->step && expr_eval_number(in->step, &step) != 0)) {
+                return executed;
+            }
+            if (loop_push_for(in->slot, start_val, end_val, step, pc + 1) != 0) {
+                return executed;
+            }
+            if (!loop_for_should_continue()) {
+                // Already past the limit: the body runs zero times
+                loop_pop();
+                pc = in->arg;
+                DISPATCH();
+            }
+            pc++;
+            DISPATCH();
+        }
+        HANDLER(OP_NEXT):
+            pc = next(in->slot, pc);
+            if (pc < 0) return executed;
+            DISPATCH();
+        HANDLER(OP_LET_NEXT):
+            let(in);
+            pc = next(in->arg, pc);
+            if (pc < 0) return executed;
+            DISPATCH();
+        HANDLER(OP_INC_NEXT):
+            inc(in);
+            pc = next(in->arg, pc);
+            if (pc < 0) return executed;
+            DISPATCH();
+        HANDLER(OP_WHILE):
+            // Paired at compile time, so WHILE loops need no runtime frame
+            pc = expr_eval_condition(in->expr) ? pc + 1 : in->arg;
+            DISPATCH();
+        HANDLER(OP_WEND):
+            if (expr_eval_condition(code[in->arg].expr)) {
+                pc = in->arg + 1;  // Straight back into the body
+            } else {
+                pc++;
+            }
+            DISPATCH();
+        HANDLER(OP_GOTO):
+            // Targets were resolved and checked when the program was linked
+            pc = in->arg;
+            DISPATCH();
+        HANDLER(OP_GOSUB):
+            if (gosub_push_return(pc + 1) != 0) {
+                return executed;
+            }
+            pc = in->arg;
+            DISPATCH();
+        HANDLER(OP_ON_GOTO): {
+            // One table lookup, however many targets there are
+            int32_t value;
+            if (expr_eval_number(in->expr, &value) != 0) {
+                return executed;
+            }
+            int target = jump_table_find(in->table, value);
+            pc = (target >= 0) ? target : pc + 1;
+            DISPATCH();
+        }
+        HANDLER(OP_ON_GOSUB): {
+            int32_t value;
+            if (expr_eval_number(in->expr, &value) != 0) {
+                return executed;
+            }
+            int target = jump_table_find(in->table, value);
+            if (target < 0) {
+                pc++;
+                DISPATCH();
+            }
+            if (gosub_push_return(pc + 1) != 0) {
+                return executed;
+            }
+            pc = target;
+            DISPATCH();
+        }
+        HANDLER(OP_SELECT): {
+            int32_t value;
+            if (expr_eval_number(in->expr, &value) != 0) {
+                return executed;
+            }
+            int target = jump_table_find(in->table, value);
+            pc = (target >= 0) ? target : in->arg;
+            DISPATCH();
+        }
+        HANDLER(OP_RETURN):
+            if (!gosub_has_return()) {
+                printf("?RETURN WITHOUT GOSUB\n");
+                pc++;
+            } else {
+                pc = gosub_pop_return();
+            }
+            DISPATCH();
+        HANDLER(OP_END):
+            return executed;
+#ifndef VM_THREADED
+        default:
+            return executed;
+#endif
+        }
+#ifndef VM_THREADED
+    }
+#endif
+#undef HANDLER
+#undef DISPATCH
+
+interrupted:
+    should_stop_execution();  // Clears the flag
+    printf("BREAK\n");
+    return executed;
+}
+
+uint32_t vm_run(void) {
+    if (running) {
+        printf("?ILLEGAL IN PROGRAM\n");
+        return 0;
+    }
+    
+    uint32_t executed = 0;
+    running = 1;
+    do {
+        rerun = 0;
+        if (compile_program(&compiled) != 0) {
+            break;
+        }
+        loop_init();
+        data_seek(0);
+        executed += vm_run_code(compiled.code, compiled.length);
+        if (rerun) {
+            var_init();  // As RUN typed at the prompt does
+        }
+    } while (rerun);
+    running = 0;
+    return executed;
+}
@@ -0,0 +1,19 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+#include "compiler.h"
+
+// Compile the stored program and run it. Not from inside a running
+// program (prints ?ILLEGAL IN PROGRAM); RUN in a program starts it over.
+// Returns the number of instructions executed
+uint32_t vm_run(void);
+
+// Run already compiled code from its first instruction
+// Returns the number of instructions executed
+uint32_t vm_run_code(Instr *code, int length);
+
+// How this build dispatches instructions: "threaded" or "switch"
+const char* vm_dispatch_name(void);
+
+#endif